@@ -2,82 +2,889 @@
  * Check license.txt in project root for license information *
  *********************************************************** */
 
+// bus.h
+static u8 bus_read8(u16 addr);
+
 #ifndef APU_H
 #define APU_H
 
 #include <SDL2/SDL.h>
 #include "defs.h"
+#include "audioring.h"
+#include "blip.h"
+
+// APU
+//
+// APU is not clocked with the cpu. Registers are written and read through
+// apu_write and apu_read_status, which first run the channels up to the
+// current cpu cycle, and the rest is run once per frame by apu_end_frame.
+// Channels jump from one timer clock to the next and only report when their
+// output level changes. Level change updates the nonlinear mix and the change
+// of the mix is added as band-limited step to the blip buffer (blip.h) at the
+// cpu cycle it happened, so the output sample rate is reached without per
+// cycle work. Blip buffer is integrated to samples once per frame.
+//
+// Frame IRQ and DMC sample fetches are the only things the cpu sees at exact
+// cycles. Their next cpu cycle is known ahead (frame step, DMC bits left in
+// the output unit), so it is scheduled as ppu event (ppu_schedule_apu_event)
+// and the apu is run to it then. Fetch stalls the cpu and IRQ flags are held
+// on cpu.irqLines until acknowledged.
+//
+// Samples go to the SDL audio callback through a lock free ring. When
+// emulation is paced by clock (pacing.h) ring fill drifts, so blip buffer
+// rate is adjusted up to APU_RATE_CONTROL from the nominal rate to keep the
+// ring about APU_TARGET_FILL full, small enough change to not be heard as
+// pitch. When emulation is paced by audio the rate is left nominal.
 
 #define SAMPLES_PER_SECOND  44100
 #define SAMPLE_BUFFER_SIZE  1024
 
+// NTSC cpu clock
+#define APU_CLOCK_RATE      1789773
+
+#define APU_START           0x4000
+#define APU_END             0x4017
+#define APU_STATUS          0x4015
+#define APU_FRAME_COUNTER   0x4017
+
+// cpu cycles DMC memory reader takes from the cpu per sample byte
+#define APU_DMC_STALL_CYCLES    4
+
+// callback takes SAMPLE_BUFFER_SIZE samples at a time, ring is kept at
+// target fill with +-0.5% rate changes
+#define APU_TARGET_FILL     (SAMPLE_BUFFER_SIZE * 2)
+#define APU_RATE_CONTROL    0.005
+// frames for fill error to build up to full rate change, removes the constant
+// error left when host rate is off from nominal
+#define APU_RATE_INTEGRAL   180
+
+typedef enum ApuChannel {
+    ApuPulse1,
+    ApuPulse2,
+    ApuTriangle,
+    ApuNoise,
+    ApuDmc,
+    ApuChannelCount
+} ApuChannel;
+
+typedef enum ApuStatus {
+    ApuStatusPulse1     = (1 << 0),
+    ApuStatusPulse2     = (1 << 1),
+    ApuStatusTriangle   = (1 << 2),
+    ApuStatusNoise      = (1 << 3),
+    ApuStatusDmc        = (1 << 4),
+    ApuStatusFrameIrq   = (1 << 6),
+    ApuStatusDmcIrq     = (1 << 7),
+} ApuStatus;
+
+static const u8 apuLengthTable[32] = {
+    10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+    12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+static const u8 pulseDutyTable[4][8] = {
+    { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 1, 1, 0, 0, 0 },
+    { 1, 0, 0, 1, 1, 1, 1, 1 }
+};
+
+static const u8 triangleSequence[32] = {
+    15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15
+};
+
+static const u16 noisePeriodTable[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+};
+
+static const u16 dmcRateTable[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+// frame counter steps in cpu cycles from the start of the sequence, last
+// step wraps the sequence. 4 step mode sets frame IRQ on the last step
+static const u32 frameStepCycles[2][4] = {
+    { 7457, 14913, 22371, 29829 },
+    { 7457, 14913, 22371, 37281 }
+};
+static const u32 frameSequenceCycles[2] = { 29830, 37282 };
+
+typedef struct Envelope {
+    u8  start;
+    u8  loop;       // also halts length counter
+    u8  constant;
+    u8  period;     // constant volume when constant is set
+    u8  divider;
+    u8  decay;
+} Envelope;
+
 typedef struct Pulse {
-    u16 time;
+    Envelope envelope;
+    u8  duty;
+    u8  step;
+    u8  length;
+    u16 timer;
+
+    u8  sweepEnabled;
+    u8  sweepPeriod;
+    u8  sweepNegate;
+    u8  sweepShift;
+    u8  sweepDivider;
+    u8  sweepReload;
+    // pulse 1 negates with ones' complement
+    u8  onesComplement;
+
+    u64 nextClock;
 } Pulse;
 
+typedef struct Triangle {
+    u8  control;    // also halts length counter
+    u8  linearReloadValue;
+    u8  linearCounter;
+    u8  linearReload;
+    u8  length;
+    u8  step;
+    u16 timer;
+
+    u64 nextClock;
+} Triangle;
+
+typedef struct Noise {
+    Envelope envelope;
+    u8  mode;
+    u8  length;
+    u8  period;     // index to noisePeriodTable
+    u16 shift;
+
+    u64 nextClock;
+} Noise;
+
+typedef struct Dmc {
+    u8  irqEnabled;
+    u8  loop;
+    u8  rate;       // index to dmcRateTable
+    u16 sampleAddr;
+    u16 sampleLen;
+
+    // memory reader
+    u16 addr;
+    u16 bytesRemaining;
+    u8  buffer;
+    u8  bufferFull;
+
+    // output unit
+    u8  level;
+    u8  shift;
+    u8  bitsRemaining;
+    u8  silence;
+
+    u64 nextClock;
+} Dmc;
+
 struct APU {
-    Pulse pulses[2];
+    Pulse       pulses[2];
+    Triangle    triangle;
+    Noise       noise;
+    Dmc         dmc;
+
+    // $4015 channel enables
+    u8          enabled;
+    u8          frameIrq;
+    u8          dmcIrq;
+
+    // $4017
+    u8          frameMode;
+    u8          irqInhibit;
+    u8          frameStep;
+    u64         frameStart;
+    u64         frameNext;
+
+    // cpu cycle apu has run to
+    u64         cycle;
+
+    // output level of each channel and their mix, mix of all channels at
+    // full level is about 1.0
+    u8          levels[ApuChannelCount];
+    float       mix;
+    float       pulseMix[31];
+    float       tndMix[203];
+
+    // set before apu_init, SAMPLES_PER_SECOND and BlipMedium when 0
+    u32         sampleRate;
+    BlipQuality quality;
+
+    Blip        blip;
+    float       samples[BLIP_BUFFER_SIZE];
+
+    // 0 when audio device did not open
+    SDL_AudioDeviceID device;
+    u8          playing;
+    // emulation is paced by audio, rate is not adjusted
+    u8          fixedRate;
+    double      rateIntegral;
+    AudioRing   ring;
 } apu;
 
+// apu time is cpu cycles, taken from ppu so OAM DMA is counted too
+static inline u64
+apu_now() {
+    return ppu_dot() / 3;
+}
+
+static FORCE_INLINE void
+apu_set_level(ApuChannel channel, u8 level, u64 cycle) {
+
+    if(apu.levels[channel] == level) return;
+    apu.levels[channel] = level;
+
+    float mix = apu.pulseMix[apu.levels[ApuPulse1] + apu.levels[ApuPulse2]] +
+        apu.tndMix[3 * apu.levels[ApuTriangle] + 2 * apu.levels[ApuNoise] + apu.levels[ApuDmc]];
+    if(mix != apu.mix) {
+        blip_add_delta(&apu.blip, cycle, mix - apu.mix);
+        apu.mix = mix;
+    }
+}
+
+// timer clocks at next, next + period ... before end
+static inline u64
+apu_clocks_before(u64 next, u32 period, u64 end) {
+    return next < end ? (end - next + period - 1) / period : 0;
+}
+
+static void
+envelope_clock(Envelope* envelope) {
+
+    if(envelope->start) {
+        envelope->start = 0;
+        envelope->decay = 15;
+        envelope->divider = envelope->period;
+    } else if(envelope->divider == 0) {
+        envelope->divider = envelope->period;
+        if(envelope->decay > 0) {
+            envelope->decay--;
+        } else if(envelope->loop) {
+            envelope->decay = 15;
+        }
+    } else {
+        envelope->divider--;
+    }
+}
+
+static inline u8
+envelope_volume(Envelope* envelope) {
+    return envelope->constant ? envelope->period : envelope->decay;
+}
+
+static u16
+pulse_sweep_target(Pulse* pulse) {
+
+    u16 change = pulse->timer >> pulse->sweepShift;
+    if(pulse->sweepNegate) {
+        return pulse->timer - change - pulse->onesComplement;
+    }
+    return pulse->timer + change;
+}
+
+// sweep mutes the channel even when it is disabled
+static inline u8
+pulse_muted(Pulse* pulse) {
+    return pulse->timer < 8 || (!pulse->sweepNegate && pulse_sweep_target(pulse) > 0x7FF);
+}
+
+static inline u8
+pulse_volume(Pulse* pulse) {
+    return pulse->length && !pulse_muted(pulse) ? envelope_volume(&pulse->envelope) : 0;
+}
+
+static void
+pulse_run(Pulse* pulse, ApuChannel channel, u64 end) {
+
+    u32 period = (pulse->timer + 1) * 2;
+    u8 volume = pulse_volume(pulse);
+
+    if(volume == 0) {
+        // silent, only the sequencer position is kept
+        u64 clocks = apu_clocks_before(pulse->nextClock, period, end);
+        pulse->step = (pulse->step + clocks) & 0x7;
+        pulse->nextClock += clocks * period;
+        return;
+    }
+
+    while(pulse->nextClock < end) {
+        pulse->step = (pulse->step + 1) & 0x7;
+        apu_set_level(channel, pulseDutyTable[pulse->duty][pulse->step] * volume, pulse->nextClock);
+        pulse->nextClock += period;
+    }
+}
+
+static void
+pulse_half_frame(Pulse* pulse) {
+
+    if(pulse->sweepDivider == 0 && pulse->sweepEnabled && pulse->sweepShift && !pulse_muted(pulse)) {
+        pulse->timer = pulse_sweep_target(pulse);
+    }
+    if(pulse->sweepDivider == 0 || pulse->sweepReload) {
+        pulse->sweepDivider = pulse->sweepPeriod;
+        pulse->sweepReload = 0;
+    } else {
+        pulse->sweepDivider--;
+    }
+
+    if(!pulse->envelope.loop && pulse->length) pulse->length--;
+}
+
 static void
-pulse_write(Pulse* pulse, u16 addr, u8 val) {
-    switch(addr) {
+pulse_write(Pulse* pulse, u16 addr, u8 val, u8 enabled) {
 
-        case 0x4002:
+    switch(addr & 0x3) {
+        case 0:
+            {
+                // DDLC VVVV duty, length halt, constant volume, volume
+                pulse->duty = val >> 6;
+                pulse->envelope.loop = (val >> 5) & 0x1;
+                pulse->envelope.constant = (val >> 4) & 0x1;
+                pulse->envelope.period = val & 0xF;
+            } break;
+        case 1:
+            {
+                // EPPP NSSS sweep enable, period, negate, shift
+                pulse->sweepEnabled = val >> 7;
+                pulse->sweepPeriod = (val >> 4) & 0x7;
+                pulse->sweepNegate = (val >> 3) & 0x1;
+                pulse->sweepShift = val & 0x7;
+                pulse->sweepReload = 1;
+            } break;
+        case 2:
             {
                 // Time low bits
-                pulse->time &= 0xFF00;
-                pulse->time |= val;
+                pulse->timer = (pulse->timer & 0x700) | val;
             } break;
-        case 0x4003:
+        case 3:
             {
-                // Time high bits
-                pulse->time &= 0x00FF;
-                pulse->time |= val;
+                // LLLL LTTT length and time high bits, restarts sequence
+                pulse->timer = (pulse->timer & 0xFF) | ((val & 0x7) << 8);
+                if(enabled) pulse->length = apuLengthTable[val >> 3];
+                pulse->step = 0;
+                pulse->envelope.start = 1;
             } break;
-        default:
-            ABORT("Error address in pulse 0x%04X", addr);
     }
 }
 
 static void
-apu_init() {
+triangle_run(Triangle* triangle, u64 end) {
 
-    //SDL_setenv("SDL_AUDIODRIVER", "disk", 1);
-    SDL_setenv("SDL_AUDIODRIVER", "directsound", 1);
+    u32 period = triangle->timer + 1;
 
-    SDL_Init(SDL_INIT_AUDIO);
+    // periods below 2 are ultrasonic and are held at the current level
+    if(!triangle->length || !triangle->linearCounter || triangle->timer < 2) {
+        triangle->nextClock += apu_clocks_before(triangle->nextClock, period, end) * period;
+        return;
+    }
 
-    // Open our audio device; Sample Rate will dictate the pace of our synthesizer
-    //SDLInitAudio(44100, 1024);
+    while(triangle->nextClock < end) {
+        triangle->step = (triangle->step + 1) & 0x1F;
+        apu_set_level(ApuTriangle, triangleSequence[triangle->step], triangle->nextClock);
+        triangle->nextClock += period;
+    }
+}
 
-    SDL_AudioSpec AudioSettings = { 0 };
+static void
+triangle_quarter_frame(Triangle* triangle) {
 
-    AudioSettings.freq = SAMPLES_PER_SECOND;
-    //  One of the modes that doesn't produce a high frequent pitched tone when having silence
-    AudioSettings.format = AUDIO_F32SYS;
-    AudioSettings.channels = 2;
-    AudioSettings.samples = SAMPLE_BUFFER_SIZE;
+    if(triangle->linearReload) {
+        triangle->linearCounter = triangle->linearReloadValue;
+    } else if(triangle->linearCounter) {
+        triangle->linearCounter--;
+    }
+    if(!triangle->control) triangle->linearReload = 0;
+}
+
+static void
+triangle_write(Triangle* triangle, u16 addr, u8 val, u8 enabled) {
+
+    switch(addr & 0x3) {
+        case 0:
+            {
+                // CRRR RRRR length halt and linear counter reload value
+                triangle->control = val >> 7;
+                triangle->linearReloadValue = val & 0x7F;
+            } break;
+        case 2:
+            {
+                triangle->timer = (triangle->timer & 0x700) | val;
+            } break;
+        case 3:
+            {
+                triangle->timer = (triangle->timer & 0xFF) | ((val & 0x7) << 8);
+                if(enabled) triangle->length = apuLengthTable[val >> 3];
+                triangle->linearReload = 1;
+            } break;
+    }
+}
+
+static inline u8
+noise_volume(Noise* noise) {
+    return noise->length ? envelope_volume(&noise->envelope) : 0;
+}
+
+static void
+noise_run(Noise* noise, u64 end) {
+
+    u32 period = noisePeriodTable[noise->period];
+    u8 volume = noise_volume(noise);
+
+    if(volume == 0) {
+        // shift reqister is not stepped while silent, it is random anyway
+        noise->nextClock += apu_clocks_before(noise->nextClock, period, end) * period;
+        return;
+    }
+
+    // at fast periods most steps keep the level, compared here before the call
+    u8 tap = noise->mode ? 6 : 1;
+    u8 level = apu.levels[ApuNoise];
+    u16 shift = noise->shift;
+    u64 clock = noise->nextClock;
+    while(clock < end) {
+        u16 feedback = (shift ^ (shift >> tap)) & 0x1;
+        shift = (shift >> 1) | (feedback << 14);
+        u8 next = shift & 0x1 ? 0 : volume;
+        if(next != level) {
+            apu_set_level(ApuNoise, next, clock);
+            level = next;
+        }
+        clock += period;
+    }
+    noise->shift = shift;
+    noise->nextClock = clock;
+}
+
+static void
+noise_write(Noise* noise, u16 addr, u8 val, u8 enabled) {
+
+    switch(addr & 0x3) {
+        case 0:
+            {
+                // --LC VVVV length halt, constant volume, volume
+                noise->envelope.loop = (val >> 5) & 0x1;
+                noise->envelope.constant = (val >> 4) & 0x1;
+                noise->envelope.period = val & 0xF;
+            } break;
+        case 2:
+            {
+                // M--- PPPP mode and period
+                noise->mode = val >> 7;
+                noise->period = val & 0xF;
+            } break;
+        case 3:
+            {
+                if(enabled) noise->length = apuLengthTable[val >> 3];
+                noise->envelope.start = 1;
+            } break;
+    }
+}
+
+static void
+dmc_restart(Dmc* dmc) {
+    dmc->addr = dmc->sampleAddr;
+    dmc->bytesRemaining = dmc->sampleLen;
+}
+
+// memory reader fills the sample buffer when it is empty
+static void
+dmc_fetch(Dmc* dmc) {
 
-    SDL_OpenAudio(&AudioSettings, 0);
+    if(dmc->bufferFull || dmc->bytesRemaining == 0) return;
 
-    //if (!SoundIsPlaying)
+    cpu.cycles += APU_DMC_STALL_CYCLES;
+    dmc->buffer = bus_read8(dmc->addr);
+    dmc->bufferFull = 1;
+    dmc->addr = dmc->addr == 0xFFFF ? 0x8000 : dmc->addr + 1;
+    dmc->bytesRemaining--;
 
-    {
-        // start playing the audio
-        SDL_PauseAudio(0);
-        //SoundIsPlaying = true;
+    if(dmc->bytesRemaining == 0) {
+        if(dmc->loop) {
+            dmc_restart(dmc);
+        } else if(dmc->irqEnabled) {
+            apu.dmcIrq = 1;
+        }
     }
 }
 
+static void
+dmc_run(Dmc* dmc, u64 end) {
+
+    u32 period = dmcRateTable[dmc->rate];
+
+    if(dmc->silence && !dmc->bufferFull && dmc->bytesRemaining == 0) {
+        // nothing to play, only the bit counter is kept
+        u64 clocks = apu_clocks_before(dmc->nextClock, period, end);
+        dmc->bitsRemaining = (dmc->bitsRemaining - 1 + 8 - clocks % 8) % 8 + 1;
+        dmc->nextClock += clocks * period;
+        return;
+    }
+
+    while(dmc->nextClock < end) {
+        if(!dmc->silence) {
+            if(dmc->shift & 0x1) {
+                if(dmc->level <= 125) dmc->level += 2;
+            } else {
+                if(dmc->level >= 2) dmc->level -= 2;
+            }
+            dmc->shift >>= 1;
+            apu_set_level(ApuDmc, dmc->level, dmc->nextClock);
+        }
+
+        if(--dmc->bitsRemaining == 0) {
+            dmc->bitsRemaining = 8;
+            dmc->silence = !dmc->bufferFull;
+            if(dmc->bufferFull) {
+                dmc->shift = dmc->buffer;
+                dmc->bufferFull = 0;
+                dmc_fetch(dmc);
+            }
+        }
+        dmc->nextClock += period;
+    }
+}
+
+static void
+dmc_write(Dmc* dmc, u16 addr, u8 val) {
+
+    switch(addr & 0x3) {
+        case 0:
+            {
+                // IL-- RRRR IRQ enable, loop, rate
+                dmc->irqEnabled = val >> 7;
+                dmc->loop = (val >> 6) & 0x1;
+                dmc->rate = val & 0xF;
+                if(!dmc->irqEnabled) apu.dmcIrq = 0;
+            } break;
+        case 1:
+            {
+                // direct load of output level
+                dmc->level = val & 0x7F;
+            } break;
+        case 2:
+            {
+                dmc->sampleAddr = 0xC000 + val * 64;
+            } break;
+        case 3:
+            {
+                dmc->sampleLen = val * 16 + 1;
+            } break;
+    }
+}
+
+// sets the levels that are not set by the channel timers
+static void
+apu_refresh_levels(u64 cycle) {
+
+    for(u32 i = 0; i < 2; i++) {
+        Pulse* pulse = &apu.pulses[i];
+        apu_set_level(ApuPulse1 + i, pulseDutyTable[pulse->duty][pulse->step] * pulse_volume(pulse), cycle);
+    }
+    apu_set_level(ApuTriangle, triangleSequence[apu.triangle.step], cycle);
+    apu_set_level(ApuNoise, apu.noise.shift & 0x1 ? 0 : noise_volume(&apu.noise), cycle);
+    apu_set_level(ApuDmc, apu.dmc.level, cycle);
+}
+
+static void
+apu_quarter_frame() {
+
+    envelope_clock(&apu.pulses[0].envelope);
+    envelope_clock(&apu.pulses[1].envelope);
+    envelope_clock(&apu.noise.envelope);
+    triangle_quarter_frame(&apu.triangle);
+}
+
+static void
+apu_half_frame() {
+
+    pulse_half_frame(&apu.pulses[0]);
+    pulse_half_frame(&apu.pulses[1]);
+    if(!apu.triangle.control && apu.triangle.length) apu.triangle.length--;
+    if(!apu.noise.envelope.loop && apu.noise.length) apu.noise.length--;
+}
+
+static void
+apu_frame_restart(u64 cycle) {
+
+    apu.frameStart = cycle;
+    apu.frameStep = 0;
+    apu.frameNext = cycle + frameStepCycles[apu.frameMode][0];
+}
+
+static void
+apu_frame_step() {
+
+    apu_quarter_frame();
+    if(apu.frameStep & 0x1) apu_half_frame();
+
+    if(apu.frameStep == 3) {
+        if(apu.frameMode == 0 && !apu.irqInhibit) apu.frameIrq = 1;
+        apu.frameStart += frameSequenceCycles[apu.frameMode];
+        apu.frameStep = 0;
+    } else {
+        apu.frameStep++;
+    }
+
+    apu_refresh_levels(apu.frameNext);
+    apu.frameNext = apu.frameStart + frameStepCycles[apu.frameMode][apu.frameStep];
+}
+
+// cpu cycle the sample buffer is next emptied and filled, 0 if it is not
+static u64
+dmc_fetch_cycle(Dmc* dmc) {
+
+    if(!dmc->bufferFull || dmc->bytesRemaining == 0) return 0;
+    return dmc->nextClock + (u64)(dmc->bitsRemaining - 1) * dmcRateTable[dmc->rate];
+}
+
+// runs channels and frame counter to cpu cycle end
+static void
+apu_run(u64 end) {
+
+    while(apu.cycle < end) {
+
+        u64 next = apu.frameNext < end ? apu.frameNext : end;
+
+        pulse_run(&apu.pulses[0], ApuPulse1, next);
+        pulse_run(&apu.pulses[1], ApuPulse2, next);
+        triangle_run(&apu.triangle, next);
+        noise_run(&apu.noise, next);
+        dmc_run(&apu.dmc, next);
+
+        apu.cycle = next;
+        if(next == apu.frameNext) apu_frame_step();
+    }
+}
+
+// IRQ lines follow the flags, next event is the frame IRQ or the next DMC
+// fetch. Called after apu state changes
+static void
+apu_update_events() {
+
+    cpu.irqLines = (cpu.irqLines & ~(IrqApuFrame | IrqApuDmc)) |
+        (apu.frameIrq ? IrqApuFrame : 0) | (apu.dmcIrq ? IrqApuDmc : 0);
+
+    u64 cycle = 0;
+    if(apu.frameMode == 0 && !apu.irqInhibit && !apu.frameIrq) {
+        // frame step runs when apu_run reaches its cycle
+        cycle = apu.frameStart + frameStepCycles[0][3];
+    }
+    u64 fetch = dmc_fetch_cycle(&apu.dmc);
+    if(fetch) {
+        // channel clocks run when apu_run is past their cycle
+        fetch += 1;
+        if(!cycle || fetch < cycle) cycle = fetch;
+    }
+    ppu_schedule_apu_event(cycle * 3);
+}
+
+// ppu event at the cycle set by apu_update_events
+static void
+apu_event() {
+
+    apu_run(apu_now());
+    apu_update_events();
+}
+
+static u8
+apu_peak_status() {
+
+    return (apu.pulses[0].length ? ApuStatusPulse1 : 0) |
+        (apu.pulses[1].length ? ApuStatusPulse2 : 0) |
+        (apu.triangle.length ? ApuStatusTriangle : 0) |
+        (apu.noise.length ? ApuStatusNoise : 0) |
+        (apu.dmc.bytesRemaining ? ApuStatusDmc : 0) |
+        (apu.frameIrq ? ApuStatusFrameIrq : 0) |
+        (apu.dmcIrq ? ApuStatusDmcIrq : 0);
+}
+
+// $4015 read acknowledges frame IRQ
+static u8
+apu_read_status() {
+
+    apu_run(apu_now());
+    u8 status = apu_peak_status();
+    apu.frameIrq = 0;
+    apu_update_events();
+    return status;
+}
+
 static void
 apu_write(u16 addr, u8 data) {
 
+    apu_run(apu_now());
+    u64 cycle = apu.cycle;
+
     if(address_is_between(addr, 0x4000, 0x4003)) {
-        pulse_write(&apu.pulses[0],addr, data);
+        pulse_write(&apu.pulses[0], addr, data, apu.enabled & ApuStatusPulse1);
+    } else if(address_is_between(addr, 0x4004, 0x4007)) {
+        pulse_write(&apu.pulses[1], addr, data, apu.enabled & ApuStatusPulse2);
+    } else if(address_is_between(addr, 0x4008, 0x400B)) {
+        triangle_write(&apu.triangle, addr, data, apu.enabled & ApuStatusTriangle);
+    } else if(address_is_between(addr, 0x400C, 0x400F)) {
+        noise_write(&apu.noise, addr, data, apu.enabled & ApuStatusNoise);
+    } else if(address_is_between(addr, 0x4010, 0x4013)) {
+        dmc_write(&apu.dmc, addr, data);
+    } else if(addr == APU_STATUS) {
+        // ---D NT21 channel enables, disabling clears length counters
+        apu.enabled = data & 0x1F;
+        if(!(data & ApuStatusPulse1)) apu.pulses[0].length = 0;
+        if(!(data & ApuStatusPulse2)) apu.pulses[1].length = 0;
+        if(!(data & ApuStatusTriangle)) apu.triangle.length = 0;
+        if(!(data & ApuStatusNoise)) apu.noise.length = 0;
+        if(!(data & ApuStatusDmc)) {
+            apu.dmc.bytesRemaining = 0;
+        } else if(apu.dmc.bytesRemaining == 0) {
+            dmc_restart(&apu.dmc);
+            dmc_fetch(&apu.dmc);
+        }
+        apu.dmcIrq = 0;
+    } else if(addr == APU_FRAME_COUNTER) {
+        // MI-- ---- 5 step mode, IRQ inhibit
+        apu.frameMode = data >> 7;
+        apu.irqInhibit = (data >> 6) & 0x1;
+        if(apu.irqInhibit) apu.frameIrq = 0;
+        apu_frame_restart(cycle);
+        if(apu.frameMode) {
+            apu_quarter_frame();
+            apu_half_frame();
+        }
+    }
+
+    apu_refresh_levels(cycle);
+    apu_update_events();
+}
+
+// SDL audio thread, mono samples from the ring are spread to stereo
+static void
+apu_audio_callback(void* userdata, u8* stream, i32 len) {
+
+    AudioRing* ring = (AudioRing*)userdata;
+    float* out = (float*)stream;
+    u32 frames = len / (2 * sizeof(float));
+
+    u32 count = audioring_read(ring, out, frames);
+    if(count) ring->last = out[count - 1];
+    if(count < frames) ring->underruns++;
+
+    // backwards so mono samples are not overwritten before they are spread
+    for(u32 i = frames; i-- > 0;) {
+        float sample = i < count ? out[i] : ring->last;
+        out[i * 2] = sample;
+        out[i * 2 + 1] = sample;
+    }
+}
+
+// keeps ring at target fill by changing the rate samples are made
+static void
+apu_rate_control() {
+
+    u32 fill = audioring_count(&apu.ring);
+    double error = ((double)APU_TARGET_FILL - fill) / APU_TARGET_FILL;
+    if(error > 1.0) error = 1.0;
+    if(error < -1.0) error = -1.0;
+
+    apu.rateIntegral += error / APU_RATE_INTEGRAL;
+    if(apu.rateIntegral > 1.0) apu.rateIntegral = 1.0;
+    if(apu.rateIntegral < -1.0) apu.rateIntegral = -1.0;
+
+    double control = error + apu.rateIntegral;
+    if(control > 1.0) control = 1.0;
+    if(control < -1.0) control = -1.0;
+
+    blip_set_rate(&apu.blip, 1.0 + APU_RATE_CONTROL * control);
+}
+
+// runs apu to the end of the frame and passes the samples to the audio
+// thread, returns number of samples made to apu.samples
+static u32
+apu_end_frame() {
+
+    apu_run(apu_now());
+    apu_update_events();
+    u32 count = blip_end_frame(&apu.blip, apu.cycle);
+    blip_read_samples(&apu.blip, apu.samples, count);
+
+    if(!apu.device) return count;
+
+    audioring_write(&apu.ring, apu.samples, count);
+    if(!apu.fixedRate) apu_rate_control();
+
+    // playback starts once there is enough to not underrun right away
+    if(!apu.playing && audioring_count(&apu.ring) >= APU_TARGET_FILL) {
+        SDL_PauseAudioDevice(apu.device, 0);
+        apu.playing = 1;
+    }
+    return count;
+}
+
+// channels and mixer without audio device
+static void
+apu_reset() {
+
+    // nonlinear mixer of the two channel groups
+    for(u32 i = 1; i < SIZEOF_ARRAY(apu.pulseMix); i++) {
+        apu.pulseMix[i] = 95.52 / (8128.0 / i + 100.0);
+    }
+    for(u32 i = 1; i < SIZEOF_ARRAY(apu.tndMix); i++) {
+        apu.tndMix[i] = 163.67 / (24329.0 / i + 100.0);
+    }
+
+    if(!apu.sampleRate) apu.sampleRate = SAMPLES_PER_SECOND;
+    if(!apu.quality) apu.quality = BlipMedium;
+    blip_init(&apu.blip, apu.sampleRate, APU_CLOCK_RATE, apu.quality);
+    LOG("audio %u Hz, %u tap %s resampler", apu.sampleRate, apu.quality, apu.blip.applyName);
+
+    apu.pulses[0].onesComplement = 1;
+    apu.noise.shift = 1;
+    apu.dmc.bitsRemaining = 8;
+    apu.dmc.silence = 1;
+
+    apu.cycle = apu.blip.frameStart = apu_now();
+    apu_frame_restart(apu.cycle);
+    apu_update_events();
+}
+
+static void
+apu_init() {
+
+    // driver is picked by SDL, SDL_AUDIODRIVER=dummy or disk works without sound card
+    SDL_InitSubSystem(SDL_INIT_AUDIO);
+
+    SDL_AudioSpec spec = { 0 };
+    if(!apu.sampleRate) apu.sampleRate = SAMPLES_PER_SECOND;
+    spec.freq = apu.sampleRate;
+    //  One of the modes that doesn't produce a high frequent pitched tone when having silence
+    spec.format = AUDIO_F32SYS;
+    spec.channels = 2;
+    spec.samples = SAMPLE_BUFFER_SIZE;
+    spec.callback = apu_audio_callback;
+    spec.userdata = &apu.ring;
+
+    // SDL converts if the device wants something else
+    apu.device = SDL_OpenAudioDevice(NULL, 0, &spec, NULL, 0);
+    if(apu.device) {
+        LOG("audio driver %s", SDL_GetCurrentAudioDriver());
     } else {
-        LOG("apu todo address implementation");
+        LOG("no audio: %s", SDL_GetError());
+    }
+
+    apu_reset();
+}
+
+static void
+apu_dispose() {
+
+    if(apu.device) {
+        SDL_CloseAudioDevice(apu.device);
+        LOG("audio underruns %u", apu.ring.underruns);
     }
+    apu.device = 0;
+    apu.playing = 0;
 }
 
 #endif /* APU_H */
@@ -0,0 +1,71 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef AUDIORING_H
+#define AUDIORING_H
+
+#include "defs.h"
+
+// Single producer single consumer ring of mono samples between emulation
+// (producer) and the SDL audio callback (consumer). Positions run freely and
+// are masked on access, each side only stores its own position and loads the
+// other with acquire, so no locks are needed. Positions are on their own cache
+// lines so the two threads do not bounce one line between them.
+
+// power of two
+#define AUDIO_RING_SAMPLES  8192
+#define AUDIO_RING_MASK     (AUDIO_RING_SAMPLES - 1)
+
+typedef struct AudioRing {
+    float   samples[AUDIO_RING_SAMPLES];
+
+    u32     writePos __attribute__((aligned(64)));
+    u32     readPos __attribute__((aligned(64)));
+
+    // consumer only, held on underrun so it does not click
+    float   last;
+    u32     underruns;
+} AudioRing;
+
+// samples in the ring, exact from the producer side
+static inline u32
+audioring_count(AudioRing* ring) {
+    return ring->writePos - __atomic_load_n(&ring->readPos, __ATOMIC_ACQUIRE);
+}
+
+// producer, returns samples written. Samples that do not fit are dropped
+static u32
+audioring_write(AudioRing* ring, const float* src, u32 count) {
+
+    u32 write = ring->writePos;
+    u32 space = AUDIO_RING_SAMPLES - (write - __atomic_load_n(&ring->readPos, __ATOMIC_ACQUIRE));
+    if(count > space) count = space;
+
+    u32 start = write & AUDIO_RING_MASK;
+    u32 first = AUDIO_RING_SAMPLES - start < count ? AUDIO_RING_SAMPLES - start : count;
+    memcpy(ring->samples + start, src, first * sizeof(float));
+    memcpy(ring->samples, src + first, (count - first) * sizeof(float));
+
+    __atomic_store_n(&ring->writePos, write + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+// consumer, returns samples read
+static u32
+audioring_read(AudioRing* ring, float* dst, u32 count) {
+
+    u32 read = ring->readPos;
+    u32 avail = __atomic_load_n(&ring->writePos, __ATOMIC_ACQUIRE) - read;
+    if(count > avail) count = avail;
+
+    u32 start = read & AUDIO_RING_MASK;
+    u32 first = AUDIO_RING_SAMPLES - start < count ? AUDIO_RING_SAMPLES - start : count;
+    memcpy(dst, ring->samples + start, first * sizeof(float));
+    memcpy(dst + first, ring->samples, (count - first) * sizeof(float));
+
+    __atomic_store_n(&ring->readPos, read + count, __ATOMIC_RELEASE);
+    return count;
+}
+
+#endif /* AUDIORING_H */
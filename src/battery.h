@@ -0,0 +1,107 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include "defs.h"
+#include "fileload.h"
+
+// Battery backed PRG RAM
+//
+// RAM of cartridge with battery is the .sav file mapped shared, game writes
+// go straight to the page cache and saving copies nothing. Dirty pages are
+// handed to the kernel with msync(MS_ASYNC) on a timer, that only schedules
+// the write back so emulation never waits for the disk. Exit waits for it.
+//
+// With seed image RAM is a private mapping of the seed instead: every run
+// starts from the same RAM, pages are copied only when the game writes them
+// and nothing is saved.
+
+#define BATTERY_FLUSH_INTERVAL_MS   1000
+
+struct Battery {
+    // directory for .sav files, next to the rom when NULL
+    const char* directory;
+    // RAM image to start from instead of the .sav file
+    const char* seed;
+
+    char        path[1024];
+    u8*         ram;
+    size_t      size;
+    u8          shared;
+    u32         lastFlush;
+} battery;
+
+// rom path with .sav extension, in battery.directory if set
+static void
+battery_save_path(char* buffer, size_t bufferLen, const char* romPath) {
+
+    const char* name = romPath;
+    if(battery.directory) {
+        const char* slash = strrchr(romPath, '/');
+        if(slash) name = slash + 1;
+        snprintf(buffer, bufferLen, "%s/%s", battery.directory, name);
+    } else {
+        snprintf(buffer, bufferLen, "%s", romPath);
+    }
+
+    char* dot = strrchr(buffer, '.');
+    char* slash = strrchr(buffer, '/');
+    if(!dot || (slash && dot < slash)) dot = buffer + strlen(buffer);
+    snprintf(dot, bufferLen - (dot - buffer), ".sav");
+}
+
+// Returns NULL if file can not be mapped
+static u8*
+battery_ram_acquire(const char* romPath, size_t size) {
+
+    ASSERT_MESSAGE(!battery.ram, "battery RAM is already in use");
+
+    if(battery.seed) {
+        snprintf(battery.path, sizeof(battery.path), "%s", battery.seed);
+        battery.shared = 0;
+    } else {
+        battery_save_path(battery.path, sizeof(battery.path), romPath);
+        battery.shared = 1;
+    }
+
+    battery.ram = map_writable_file(battery.path, size, battery.shared);
+    if(!battery.ram) {
+        LOG("failed to map battery RAM %s", battery.path);
+        return NULL;
+    }
+    battery.size = size;
+    LOG("battery RAM %s%s", battery.path, battery.shared ? "" : " (seed, not saved)");
+    return battery.ram;
+}
+
+// wait is only for exit, otherwise write back is just scheduled
+static void
+battery_flush(u8 wait) {
+
+    if(battery.ram && battery.shared) {
+        msync(battery.ram, battery.size, wait ? MS_SYNC : MS_ASYNC);
+    }
+}
+
+static void
+battery_update(u32 ticks) {
+
+    if(ticks - battery.lastFlush >= BATTERY_FLUSH_INTERVAL_MS) {
+        battery_flush(0);
+        battery.lastFlush = ticks;
+    }
+}
+
+static void
+battery_ram_release() {
+
+    battery_flush(1);
+    unmap_file(battery.ram, battery.size);
+    battery.ram = NULL;
+    battery.size = 0;
+}
+
+#endif /* BATTERY_H */
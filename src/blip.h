@@ -0,0 +1,238 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef BLIP_H
+#define BLIP_H
+
+#include <math.h>
+#include "defs.h"
+
+#if defined(__SSE2__)
+#define BLIP_SSE2
+#include <immintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BLIP_AVX2
+#endif
+
+// Blip buffer
+//
+// Band-limited step synthesis from input clock (cpu cycles) to output sample
+// rate. Amplitude changes are added as polyphase windowed sinc kernels: the
+// fraction of the output sample a change falls on picks one of BLIP_PHASES
+// kernels of width taps, and a running sum of the buffer gives the stepped
+// waveform without aliasing. This is the decimating FIR filter, but it is
+// evaluated only where the input changes instead of on every input cycle.
+//
+// Deltas of a frame are only stored with their buffer position and applied
+// in one batch when the frame ends, in a loop of SSE2 or (when cpu has it)
+// AVX2 multiply adds over the kernel taps. Quality is the kernel width.
+
+#define BLIP_PHASE_BITS     6
+#define BLIP_PHASES         (1 << BLIP_PHASE_BITS)
+#define BLIP_MAX_WIDTH      32
+#define BLIP_FRAC_BITS      32
+#define BLIP_BUFFER_SIZE    4096
+// deltas are applied early when this many are waiting
+#define BLIP_MAX_DELTAS     8192
+// integrator leak, removes DC offset of the input (about 14 Hz high pass at 44.1 kHz)
+#define BLIP_HIGHPASS       (1.0f / 512)
+
+// kernel taps, multiple of 8 for the vector loops
+typedef enum BlipQuality {
+    BlipLow     = 8,
+    BlipMedium  = 16,
+    BlipHigh    = 32,
+} BlipQuality;
+
+typedef struct BlipDelta {
+    u32     pos;
+    u32     phase;
+    float   delta;
+} BlipDelta;
+
+typedef void (*blip_apply_func)(float* /*buffer*/, const float* /*kernels*/,
+        const BlipDelta* /*deltas*/, u32 /*count*/, u32 /*width*/);
+
+typedef struct Blip {
+    // output samples per input clock and buffer position of frameStart, 32.32 fixed
+    u64             factor;
+    double          ratio;      // factor relative to nominal sampleRate
+    u32             sampleRate;
+    u32             clockRate;
+    u64             offset;
+    u64             frameStart;
+
+    u32             width;
+    blip_apply_func apply;
+    const char*     applyName;
+
+    float           integrator;
+    u32             numDeltas;
+    BlipDelta       deltas[BLIP_MAX_DELTAS];
+
+    // width taps per phase, packed
+    float           kernels[BLIP_PHASES * BLIP_MAX_WIDTH] __attribute__((aligned(32)));
+    float           buffer[BLIP_BUFFER_SIZE + BLIP_MAX_WIDTH] __attribute__((aligned(32)));
+} Blip;
+
+static void
+blip_apply_scalar(float* buffer, const float* kernels, const BlipDelta* deltas, u32 count, u32 width) {
+
+    for(u32 d = 0; d < count; d++) {
+        float* out = buffer + deltas[d].pos;
+        const float* kernel = kernels + deltas[d].phase * width;
+        for(u32 i = 0; i < width; i++) {
+            out[i] += kernel[i] * deltas[d].delta;
+        }
+    }
+}
+
+#ifdef BLIP_SSE2
+static void
+blip_apply_sse2(float* buffer, const float* kernels, const BlipDelta* deltas, u32 count, u32 width) {
+
+    for(u32 d = 0; d < count; d++) {
+        float* out = buffer + deltas[d].pos;
+        const float* kernel = kernels + deltas[d].phase * width;
+        __m128 delta = _mm_set1_ps(deltas[d].delta);
+        for(u32 i = 0; i < width; i += 4) {
+            __m128 k = _mm_load_ps(kernel + i);
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(k, delta)));
+        }
+    }
+}
+#endif
+
+#ifdef BLIP_AVX2
+__attribute__((target("avx2,fma"))) static void
+blip_apply_avx2(float* buffer, const float* kernels, const BlipDelta* deltas, u32 count, u32 width) {
+
+    for(u32 d = 0; d < count; d++) {
+        float* out = buffer + deltas[d].pos;
+        const float* kernel = kernels + deltas[d].phase * width;
+        __m256 delta = _mm256_set1_ps(deltas[d].delta);
+        for(u32 i = 0; i < width; i += 8) {
+            __m256 k = _mm256_load_ps(kernel + i);
+            _mm256_storeu_ps(out + i, _mm256_fmadd_ps(k, delta, _mm256_loadu_ps(out + i)));
+        }
+    }
+}
+#endif
+
+// ratio scales output rate, frames already in the buffer keep their rate
+static void
+blip_set_rate(Blip* blip, double ratio) {
+
+    blip->ratio = ratio;
+    blip->factor = (u64)((double)blip->sampleRate * ratio / blip->clockRate * ((u64)1 << BLIP_FRAC_BITS));
+}
+
+static void
+blip_init(Blip* blip, u32 sampleRate, u32 clockRate, BlipQuality quality) {
+
+    memset(blip, 0, sizeof(*blip));
+    blip->sampleRate = sampleRate;
+    blip->clockRate = clockRate;
+    blip->width = quality;
+    blip_set_rate(blip, 1.0);
+
+    blip->apply = blip_apply_scalar;
+    blip->applyName = "scalar";
+#ifdef BLIP_SSE2
+    blip->apply = blip_apply_sse2;
+    blip->applyName = "sse2";
+#endif
+#ifdef BLIP_AVX2
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        blip->apply = blip_apply_avx2;
+        blip->applyName = "avx2";
+    }
+#endif
+
+    // windowed sinc, cut off a bit below nyquist. Every phase sums to 1 so a
+    // step always settles to its full size. Wider kernel has sharper cut off
+    const double cutoff = quality == BlipLow ? 0.75 : quality == BlipMedium ? 0.9 : 0.95;
+    u32 width = blip->width;
+    for(u32 phase = 0; phase < BLIP_PHASES; phase++) {
+
+        double taps[BLIP_MAX_WIDTH];
+        double sum = 0;
+        for(u32 i = 0; i < width; i++) {
+            double x = ((i32)i - (i32)width / 2 + 1) - (double)phase / BLIP_PHASES;
+            double sinc = x == 0 ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+            double window = 0.42 + 0.5 * cos(2 * M_PI * x / width) + 0.08 * cos(4 * M_PI * x / width);
+            taps[i] = sinc * window;
+            sum += taps[i];
+        }
+        for(u32 i = 0; i < width; i++) {
+            blip->kernels[phase * width + i] = (float)(taps[i] / sum);
+        }
+    }
+}
+
+static void
+blip_apply(Blip* blip) {
+
+    blip->apply(blip->buffer, blip->kernels, blip->deltas, blip->numDeltas, blip->width);
+    blip->numDeltas = 0;
+}
+
+static FORCE_INLINE void
+blip_add_delta(Blip* blip, u64 clock, float delta) {
+
+    u64 fixed = blip->offset + (clock - blip->frameStart) * blip->factor;
+    u64 pos = fixed >> BLIP_FRAC_BITS;
+    // too long without blip_end_frame, debugger has stopped emulation
+    if(pos >= BLIP_BUFFER_SIZE) return;
+
+    if(blip->numDeltas == BLIP_MAX_DELTAS) blip_apply(blip);
+    blip->deltas[blip->numDeltas++] = (BlipDelta) {
+        .pos = (u32)pos,
+        .phase = (fixed >> (BLIP_FRAC_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1),
+        .delta = delta
+    };
+}
+
+// ends frame at clock, returns number of samples ready
+static u32
+blip_end_frame(Blip* blip, u64 clock) {
+
+    blip_apply(blip);
+
+    blip->offset += (clock - blip->frameStart) * blip->factor;
+    blip->frameStart = clock;
+
+    u64 avail = blip->offset >> BLIP_FRAC_BITS;
+    if(avail > BLIP_BUFFER_SIZE) {
+        // deltas past the buffer were dropped, start over from silence
+        memset(blip->buffer, 0, sizeof(blip->buffer));
+        blip->offset &= ((u64)1 << BLIP_FRAC_BITS) - 1;
+        return 0;
+    }
+    return (u32)avail;
+}
+
+// integrates count samples
+static void
+blip_read_samples(Blip* blip, float* out, u32 count) {
+
+    float sum = blip->integrator;
+    for(u32 i = 0; i < count; i++) {
+        sum += blip->buffer[i];
+        float sample = sum;
+        if(sample > 1.0f) sample = 1.0f;
+        if(sample < -1.0f) sample = -1.0f;
+        out[i] = sample;
+        sum -= sum * BLIP_HIGHPASS;
+    }
+    blip->integrator = sum;
+
+    u32 remaining = BLIP_BUFFER_SIZE + BLIP_MAX_WIDTH - count;
+    memmove(blip->buffer, blip->buffer + count, remaining * sizeof(float));
+    memset(blip->buffer + remaining, 0, count * sizeof(float));
+    blip->offset -= (u64)count << BLIP_FRAC_BITS;
+}
+
+#endif /* BLIP_H */
@@ -0,0 +1,200 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef BREAKPOINT_H
+#define BREAKPOINT_H
+
+#include "defs.h"
+#include "printutils.h"
+#include "cpudata.h"
+
+// Breakpoints and watchpoints
+//
+// Execute breakpoints are a bit per cpu address, read and write watches are
+// bits per address too but only looked at when page of the address is flagged
+// watched. Address match is checked from the bitmaps and only then conditions
+// of the breakpoints at the address are evaluated.
+//
+// Nothing here is called from the normal cpu_clock, only from cpu_clock_hooked
+// which is used while some breakpoint (or trace, profiler) is active, so free
+// running without breakpoints has no extra checks at all.
+
+#define BREAKPOINT_MAX          64
+#define BREAKPOINT_BITMAP_SIZE  (0x10000 / 8)
+
+typedef enum BreakpointKind {
+    BreakExecute    = (1 << 0),
+    BreakRead       = (1 << 1),
+    BreakWrite      = (1 << 2),
+} BreakpointKind;
+
+// left side of condition
+typedef enum BreakpointOperand {
+    BreakAlways = 0,
+    BreakAccum,
+    BreakX,
+    BreakY,
+    BreakSP,
+    BreakStatus,
+    BreakValue,     // value read or written by the access
+} BreakpointOperand;
+
+typedef enum BreakpointCompare {
+    BreakEqual = 0,
+    BreakNotEqual,
+    BreakLess,
+    BreakGreater,
+    BreakAnd,       // any of the bits set
+} BreakpointCompare;
+
+typedef struct Breakpoint {
+    u16 addr;
+    u8  kind;
+    u8  operand;
+    u8  compare;
+    u8  value;
+} Breakpoint;
+
+struct Breakpoints {
+    u8          execute[BREAKPOINT_BITMAP_SIZE];
+    u8          read[BREAKPOINT_BITMAP_SIZE];
+    u8          write[BREAKPOINT_BITMAP_SIZE];
+    // BreakRead | BreakWrite for pages with watches
+    u8          watchedPages[256];
+
+    Breakpoint  list[BREAKPOINT_MAX];
+    u32         count;
+
+    // set when breakpoint triggers, cpu_clock_hooked stops the cpu
+    u8          hit;
+    u16         hitAddr;
+} breakpoints;
+
+static inline u8
+breakpoint_bit(u8* bitmap, u16 addr) {
+    return bitmap[addr >> 3] & (1 << (addr & 7));
+}
+
+// rebuilds bitmaps from the list
+static void
+breakpoint_update_bitmaps() {
+
+    memset(breakpoints.execute, 0, sizeof(breakpoints.execute));
+    memset(breakpoints.read, 0, sizeof(breakpoints.read));
+    memset(breakpoints.write, 0, sizeof(breakpoints.write));
+    memset(breakpoints.watchedPages, 0, sizeof(breakpoints.watchedPages));
+
+    for(u32 i = 0; i < breakpoints.count; i++) {
+        Breakpoint* bp = &breakpoints.list[i];
+        u8 bit = 1 << (bp->addr & 7);
+        if(bp->kind & BreakExecute) breakpoints.execute[bp->addr >> 3] |= bit;
+        if(bp->kind & BreakRead) breakpoints.read[bp->addr >> 3] |= bit;
+        if(bp->kind & BreakWrite) breakpoints.write[bp->addr >> 3] |= bit;
+        breakpoints.watchedPages[bp->addr >> 8] |= bp->kind & (BreakRead | BreakWrite);
+    }
+}
+
+static u8
+breakpoint_add(Breakpoint bp) {
+
+    if(breakpoints.count == BREAKPOINT_MAX) {
+        LOG("too many breakpoints");
+        return 0;
+    }
+    breakpoints.list[breakpoints.count++] = bp;
+    breakpoint_update_bitmaps();
+    return 1;
+}
+
+static void
+breakpoint_remove(u32 index) {
+
+    if(index >= breakpoints.count) return;
+    breakpoints.list[index] = breakpoints.list[--breakpoints.count];
+    breakpoint_update_bitmaps();
+}
+
+// parses condition like "A==10", "X!=FF", "SP<80", "V&80" (hex values),
+// empty condition is always true. Returns 0 on syntax error
+static u8
+breakpoint_parse_condition(const char* str, Breakpoint* bp) {
+
+    bp->operand = BreakAlways;
+    bp->compare = BreakEqual;
+    bp->value = 0;
+
+    while(*str == ' ') str++;
+    if(*str == '\0') return 1;
+
+    static const struct { const char* name; u8 operand; } operands[] = {
+        { "SP", BreakSP }, { "A", BreakAccum }, { "X", BreakX }, { "Y", BreakY },
+        { "P", BreakStatus }, { "V", BreakValue },
+    };
+    static const struct { const char* op; u8 compare; } compares[] = {
+        { "==", BreakEqual }, { "!=", BreakNotEqual }, { "<", BreakLess },
+        { ">", BreakGreater }, { "&", BreakAnd },
+    };
+
+    u32 i = 0;
+    for(; i < SIZEOF_ARRAY(operands); i++) {
+        if(strncmp(str, operands[i].name, strlen(operands[i].name)) == 0) break;
+    }
+    if(i == SIZEOF_ARRAY(operands)) return 0;
+    bp->operand = operands[i].operand;
+    str += strlen(operands[i].name);
+
+    while(*str == ' ') str++;
+    for(i = 0; i < SIZEOF_ARRAY(compares); i++) {
+        if(strncmp(str, compares[i].op, strlen(compares[i].op)) == 0) break;
+    }
+    if(i == SIZEOF_ARRAY(compares)) return 0;
+    bp->compare = compares[i].compare;
+    str += strlen(compares[i].op);
+
+    while(*str == ' ' || *str == '$') str++;
+    char* end;
+    unsigned long value = strtoul(str, &end, 16);
+    if(end == str || value > 0xFF) return 0;
+    bp->value = value;
+    return 1;
+}
+
+static u8
+breakpoint_condition(Breakpoint* bp, u8 accessValue, u8 status) {
+
+    u8 left = 0;
+    switch(bp->operand) {
+        case BreakAlways:   return 1;
+        case BreakAccum:    left = cpu.accumReq; break;
+        case BreakX:        left = cpu.Xreq; break;
+        case BreakY:        left = cpu.Yreq; break;
+        case BreakSP:       left = cpu.stackPointer; break;
+        case BreakStatus:   left = status; break;
+        case BreakValue:    left = accessValue; break;
+    }
+    switch(bp->compare) {
+        case BreakEqual:    return left == bp->value;
+        case BreakNotEqual: return left != bp->value;
+        case BreakLess:     return left < bp->value;
+        case BreakGreater:  return left > bp->value;
+        case BreakAnd:      return (left & bp->value) != 0;
+    }
+    return 0;
+}
+
+// slow path, address has some breakpoint of the kind
+static void
+breakpoint_check(u16 addr, u8 kind, u8 accessValue, u8 status) {
+
+    for(u32 i = 0; i < breakpoints.count; i++) {
+        Breakpoint* bp = &breakpoints.list[i];
+        if(bp->addr == addr && (bp->kind & kind) && breakpoint_condition(bp, accessValue, status)) {
+            breakpoints.hit = 1;
+            breakpoints.hitAddr = addr;
+            return;
+        }
+    }
+}
+
+#endif /* BREAKPOINT_H */
@@ -13,6 +13,7 @@ static void bus_write16(u16 addr, u16 data);
 
 #include "defs.h"
 #include "ppu.h"
+#include "apu.h"
 
 // cpu does not have internal memory so it is connected to memory via bus
 // 0x0 - 0xFFFF  adress range
@@ -51,6 +52,9 @@ bus_peak8(u16 addr, u8* valid) {
         ret = ram[addr & CPU_MEMORY_MIRROR_RANGE];
         if(valid) *valid = 1;
     } else if(address_is_between(addr, PPU_MEMORY_START, PPU_MEMORY_END)) {
+    } else if (addr == APU_STATUS) {
+        ret = apu_peak_status();
+        if(valid) *valid = 1;
     } else if (addr == CONTROLLER1) {
         ret = (buttonState[0] & 0x80) > 0;
         if(valid) *valid = 1;
@@ -74,6 +78,8 @@ bus_read8(u16 addr) {
         ret = ram[addr & CPU_MEMORY_MIRROR_RANGE];
     } else if(address_is_between(addr, PPU_MEMORY_START, PPU_MEMORY_END)) {
         ret = ppu_cpu_read(addr);
+    } else if (addr == APU_STATUS) {
+        ret = apu_read_status();
     } else if (addr == CONTROLLER1) {
         ret = (buttonState[0] & 0x80) > 0;
         buttonState[0] <<= 1;
@@ -98,9 +104,11 @@ bus_write8(u16 addr, u8 data) {
             || addr == PPU_DMA_WRITE_ADDRESS) {
         ppu_cpu_write(addr, data);
     } else if (addr == CONTROLLER1) {
+        // strobe latches both controllers, $4017 write goes to apu frame counter
         buttonState[0] = internalButtonState[0];
-    } else if (addr == CONTROLLER2) {
         buttonState[1] = internalButtonState[1];
+    } else if (address_is_between(addr, APU_START, APU_END)) {
+        apu_write(addr, data);
     } else if (address_is_between(addr, CARTRIDGE_MEMORY_START, CARTRIDGE_MEMORY_END)){
         cartridge_cpu_write_rom(addr, data);
     }
@@ -0,0 +1,173 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <time.h>
+#include "defs.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "nes.h"
+
+// Headless audio capture
+//
+// Runs the rom for a number of frames without window, SDL or audio device and
+// writes the APU output to a file, for audio regression checks on machines
+// with no GPU or sound card. Emulation runs as fast as it can. Output is mono
+// 32 bit float at apu.sampleRate, the same mix the audio device gets.
+// File is .wav (IEEE float) when the name ends with .wav, raw floats otherwise.
+// Samples are gathered to CAPTURE_CHUNK_SAMPLES before each write.
+
+#define CAPTURE_CHUNK_SAMPLES   (1 << 16)
+#define CAPTURE_WAV_HEADER_SIZE 58
+
+typedef enum CaptureFormat {
+    CaptureRaw,
+    CaptureWav,
+} CaptureFormat;
+
+struct AudioCapture {
+    FILE*           file;
+    CaptureFormat   format;
+    float*          chunk;
+    u32             count;
+    u64             written;    // samples
+} capture;
+
+static void
+capture_put_u32(u8* dst, u32 val) {
+    dst[0] = val; dst[1] = val >> 8; dst[2] = val >> 16; dst[3] = val >> 24;
+}
+
+static void
+capture_put_u16(u8* dst, u16 val) {
+    dst[0] = val; dst[1] = val >> 8;
+}
+
+// WAVE_FORMAT_IEEE_FLOAT needs fact chunk with the sample count
+static void
+capture_wav_header(u8* header, u64 samples) {
+
+    u32 dataSize = (u32)(samples * sizeof(float));
+    memcpy(header, "RIFF", 4);
+    capture_put_u32(header + 4, CAPTURE_WAV_HEADER_SIZE - 8 + dataSize);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    capture_put_u32(header + 16, 18);
+    capture_put_u16(header + 20, 3);                  // IEEE float
+    capture_put_u16(header + 22, 1);                  // mono
+    capture_put_u32(header + 24, apu.sampleRate);
+    capture_put_u32(header + 28, apu.sampleRate * sizeof(float));
+    capture_put_u16(header + 32, sizeof(float));
+    capture_put_u16(header + 34, 32);
+    capture_put_u16(header + 36, 0);                  // no extension
+    memcpy(header + 38, "fact", 4);
+    capture_put_u32(header + 42, 4);
+    capture_put_u32(header + 46, (u32)samples);
+    memcpy(header + 50, "data", 4);
+    capture_put_u32(header + 54, dataSize);
+}
+
+static u8
+capture_open(const char* path) {
+
+    capture.file = fopen(path, "wb");
+    if(!capture.file) {
+        LOG("failed to open capture file %s", path);
+        return 0;
+    }
+
+    size_t len = strlen(path);
+    capture.format = len >= 4 && strcmp(path + len - 4, ".wav") == 0 ? CaptureWav : CaptureRaw;
+    capture.chunk = malloc(CAPTURE_CHUNK_SAMPLES * sizeof(float));
+    capture.count = 0;
+    capture.written = 0;
+
+    // sizes are filled in on close
+    if(capture.format == CaptureWav) {
+        u8 header[CAPTURE_WAV_HEADER_SIZE];
+        capture_wav_header(header, 0);
+        fwrite(header, 1, sizeof(header), capture.file);
+    }
+    return 1;
+}
+
+static void
+capture_flush() {
+
+    fwrite(capture.chunk, sizeof(float), capture.count, capture.file);
+    capture.written += capture.count;
+    capture.count = 0;
+}
+
+static void
+capture_write(const float* samples, u32 count) {
+
+    while(count) {
+        u32 n = CAPTURE_CHUNK_SAMPLES - capture.count;
+        if(n > count) n = count;
+        memcpy(capture.chunk + capture.count, samples, n * sizeof(float));
+        capture.count += n;
+        samples += n;
+        count -= n;
+        if(capture.count == CAPTURE_CHUNK_SAMPLES) capture_flush();
+    }
+}
+
+static void
+capture_close() {
+
+    capture_flush();
+    if(capture.format == CaptureWav) {
+        u8 header[CAPTURE_WAV_HEADER_SIZE];
+        capture_wav_header(header, capture.written);
+        fseek(capture.file, 0, SEEK_SET);
+        fwrite(header, 1, sizeof(header), capture.file);
+    }
+    fclose(capture.file);
+    free(capture.chunk);
+    capture.file = NULL;
+    capture.chunk = NULL;
+}
+
+// returns process exit code
+static i32
+capture_run(const char* rom, const char* path, u32 frames) {
+
+    if(!capture_open(path)) return 1;
+
+    cartridge_load(rom);
+    cpu_reset();
+    ppu_init_headless();
+    apu_reset();
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    u32 updateCounter = 0;
+    u8 hooked = cpu_hooks_active();
+    for(u32 frame = 0; frame < frames; frame++) {
+        while(!ppu.frameComplete) {
+            nes_clock(&updateCounter, hooked);
+        }
+        ppu.frameComplete = 0;
+
+        u32 count = apu_end_frame();
+        capture_write(apu.samples, count);
+    }
+
+    capture_close();
+    cartridge_dispose();
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double audioSeconds = (double)capture.written / apu.sampleRate;
+    LOG("captured %u frames, %lu samples (%.2f s) in %.2f s, %.1fx real time", frames,
+            capture.written, audioSeconds, seconds, seconds > 0 ? audioSeconds / seconds : 0);
+    return 0;
+}
+
+#endif /* CAPTURE_H */
@@ -6,13 +6,9 @@
 #define CARTRIDGE_H
 
 #include "fileload.h"
-
-#define PROG_ROM_SINGLE_SIZE    0x4000 // 16 K
-#define CHAR_ROM_SINGLE_SIZE    0x2000 // 8 K
-
+#include "romimage.h"
 #include "mapperdata.h"
-
-#define TRAINER_SIZE            512
+#include "battery.h"
 
 // Because we dont know before hand which mapper will be used
 // this structure will store mapper functions
@@ -24,11 +20,20 @@ typedef enum MirrorType {
     ONESCREEN_HI, // TODO ??
 } MirrorType;
 
+#include "romdb.h"
+
 struct Cartridge {
     u32         mapperID;
     u32         numProgramRoms;
     u32         numCharacterRoms;
     MirrorType  mirrorType;
+    u32         crc32;      // of PRG and CHR rom, without header
+    // PRG RAM is kept in .sav file (battery.h)
+    u8          battery;
+    const char* romPath;
+
+    // shared with other cartridges loaded from the same file
+    RomImage*   image;
 } cartridge;
 
 typedef union MapperData MapperData;
@@ -38,13 +43,18 @@ typedef u8   (*cpu_read_func)(MapperData* /*data*/, u16 /*addr*/);
 typedef void (*cpu_write_func)(MapperData* /*data*/, u16 /*addr*/, u8 /*val*/);
 typedef u8   (*ppu_read_func)(MapperData* /*data*/, u16 /*addr*/);
 typedef void (*ppu_write_func)(MapperData* /*data*/, u16 /*addr*/, u8 /*val*/);
-typedef void (*mapper_init_func)(MapperData* /*data*/, u8* progMem, u8* charMem);
+typedef void (*mapper_init_func)(MapperData* /*data*/, const u8* progMem, const u8* charMem);
 typedef void (*mapper_dispose_func)(MapperData* /*data*/);
 typedef char* (*disasseble_func)(MapperData* /*data*/, u16 /*addr*/);
+typedef u32  (*prg_offset_func)(MapperData* /*data*/, u16 /*addr*/);
+typedef void (*ppu_hook_func)(MapperData* /*data*/);
 
 union MapperData {
+    MapperHeader head; // every mapper data starts with the header
     Mapper0Data mapper0;
-    //Mapper1Data mapper1;
+    Mapper1Data mapper1;
+    Mapper4Data mapper4;
+    DiscreteData discrete;
 };
 
 struct Mapper {
@@ -54,6 +64,12 @@ struct Mapper {
     ppu_write_func      ppu_write_cartridge;
     mapper_init_func    mapper_init;
     mapper_dispose_func mapper_dispose;
+    // cpu address to PRG memory offset, numeric_max_u32 if not in PRG rom
+    prg_offset_func     cpu_prg_offset;
+    // optional, called when ppu rendering config ($2000, $2001) changes and
+    // when event set with ppu_schedule_event is due
+    ppu_hook_func       ppu_config;
+    ppu_hook_func       ppu_event;
 
     /* debug utils */
     peak_func           cpu_peak_cartridge;
@@ -63,54 +79,42 @@ struct Mapper {
     MapperData          data;
 } mapper;
 
+// PRG RAM for mappers, backed by .sav file when cartridge has battery
+static u8*
+cartridge_prg_ram_alloc(u32 size) {
+
+    if(cartridge.battery) {
+        u8* ram = battery_ram_acquire(cartridge.romPath, size);
+        if(ram) return ram;
+    }
+    return calloc(size, 1);
+}
+
+static void
+cartridge_prg_ram_free(u8* ram) {
+
+    if(ram && ram == battery.ram) {
+        battery_ram_release();
+    } else {
+        free(ram);
+    }
+}
+
 #include "mappers.h"
 
 
 //STATIC_ASSERT(sizeof(union MapperData) == sizeof(u8*), mapper_union_size_wrong);
 
-// https://wiki.nesdev.com/w/index.php/INES
-// https://formats.kaitai.io/ines/index.html
-typedef struct INESHeader {
-    u32     magic;
-    u8      programRomCount;
-    u8      charaterRomCount;
-    u8      flag6;
-    u8      flag7;
-    u8      programRamLen;
-    u8      flags9;  // Rarely used
-    u8      flags10; // Rarely used
-    char    reserved[5];
-} INESHeader;
-
-STATIC_ASSERT(sizeof(INESHeader) == 16, header_size_wrong);
-
-// INES fomrat contains
-//
-// Header (16 bytes)
-// Trainer, if present (0 or 512 bytes)
-// PRG ROM data (16384 * x bytes)
-// CHR ROM data, if present (8192 * y bytes)
-// PlayChoice INST-ROM, if present (0 or 8192 bytes)
-// PlayChoice PROM, if present (16 bytes Data, 16 bytes CounterOut)
-//                  (this is often missing, see PC10 ROM-Images for details)
-
 static void
 cartridge_load(const char* name) {
-    size_t size;
-    u8* to_free;
-    u8* data = to_free = load_binary_file(name, &size);
-    if(!data) {
+
+    RomImage* image = romimage_acquire(name);
+    if(!image) {
         ABORT("failed to load cartridge");
     }
+    cartridge.image = image;
 
-    INESHeader header;
-    memcpy( &header, data, sizeof(INESHeader));
-
-    data += sizeof(INESHeader);
-    // next 512 bytes is trainer //TODO
-    if (header.flag6 & 0x04) {
-        data += TRAINER_SIZE;
-    }
+    INESHeader header = image->header;
 
     //int high = header.flag7; // TODO check
     //int low = header.flag6;
@@ -118,6 +122,8 @@ cartridge_load(const char* name) {
     cartridge.mapperID =  ((header.flag6 & 0xF0) >> 4) | (header.flag7 & 0xF0);
 
     cartridge.mirrorType = header.flag6 & 0x1 ? VERTICAL : HORIZONTAL;
+    cartridge.battery = (header.flag6 & 0x2) != 0;
+    cartridge.romPath = name;
 
     // (high << 4) | low;
 
@@ -128,12 +134,6 @@ cartridge_load(const char* name) {
 
     ASSERT_MESSAGE(cartridge.numProgramRoms, "No PRG roms detected");
 
-    u8* programMemory = data;
-    data += cartridge.numProgramRoms * PROG_ROM_SINGLE_SIZE;
-    u8* characterMemory = data;
-    data += cartridge.numCharacterRoms * CHAR_ROM_SINGLE_SIZE;
-
-
     // print signature
     char signatureName[4] = {};
     memcpy(signatureName, &header.magic, sizeof(u32));
@@ -141,29 +141,40 @@ cartridge_load(const char* name) {
     LOG("CHR ROM %d", header.charaterRomCount);
     LOG("PRG ROM %d", header.programRomCount);
 
+    cartridge.crc32 = image->crc32;
+    LOG("CRC32 %08X", cartridge.crc32);
+
+    // database knows better than the header
+    const RomDbEntry* entry = romdb_find(cartridge.crc32);
+    if(entry) {
+        cartridge.mapperID = entry->mapperID;
+        if(entry->mirroring != ROMDB_MIRROR_HEADER) cartridge.mirrorType = entry->mirroring;
+        LOG("rom database: mapper %d, mirroring %d", cartridge.mapperID, cartridge.mirrorType);
+    }
+
     switch(cartridge.mapperID) {
 
-        case 0:
-            mapper = mapper0;
+#define MAPPER_SELECT(ID, NAME, DATA)   \
+        case ID:                        \
+            mapper = NAME;              \
             break;
 
-        case 1:
-            mapper = mapper1;
-            break;
+        MAPPER_LIST(MAPPER_SELECT)
+#undef MAPPER_SELECT
 
         default:
             ABORT("NOT IMPLEMENTED MAPPER %d", cartridge.mapperID);
             break;
     }
 
-    if(mapper.mapper_init) mapper.mapper_init(&mapper.data, programMemory, characterMemory);
-
-    free(to_free);
+    if(mapper.mapper_init) mapper.mapper_init(&mapper.data, image->programRom, image->characterRom);
 }
 
 static void
 cartridge_dispose() {
     if(mapper.mapper_dispose) mapper.mapper_dispose(&mapper.data);
+    romimage_release(cartridge.image);
+    cartridge.image = NULL;
 }
 
 u8
@@ -172,9 +183,17 @@ cartridge_peak(u16 addr, u8* valid) {
     return mapper.cpu_peak_cartridge(&mapper.data, addr, valid);
 }
 
+// Reads are the hot paths, they switch on the mapper number instead of calling
+// through struct Mapper so the mapper read gets inlined. Mapper number does not
+// change after cartridge_load so the branch is always predicted
 static inline u8
 cartridge_cpu_read_rom(u16 addr) {
 
+    switch(cartridge.mapperID) {
+#define MAPPER_CPU_READ(ID, NAME, DATA) case ID: return DATA##_cpu_read(&mapper.data.DATA, addr);
+        MAPPER_LIST(MAPPER_CPU_READ)
+#undef MAPPER_CPU_READ
+    }
     return mapper.cpu_read_cartridge(&mapper.data, addr);
 }
 
@@ -189,6 +208,11 @@ cartridge_cpu_write_rom(u16 addr, u8 val) {
 static inline u8
 cartridge_ppu_read_rom(u16 addr) {
 
+    switch(cartridge.mapperID) {
+#define MAPPER_PPU_READ(ID, NAME, DATA) case ID: return DATA##_ppu_read(&mapper.data.DATA, addr);
+        MAPPER_LIST(MAPPER_PPU_READ)
+#undef MAPPER_PPU_READ
+    }
     return mapper.ppu_read_cartridge(&mapper.data, addr);
 }
 
@@ -198,6 +222,34 @@ cartridge_ppu_write_rom(u16 addr, u8 val) {
     mapper.ppu_write_cartridge(&mapper.data, addr, val);
 }
 
+static void
+cartridge_ppu_config() {
+
+    if(mapper.ppu_config) mapper.ppu_config(&mapper.data);
+}
+
+static void
+cartridge_ppu_event() {
+
+    if(mapper.ppu_event) mapper.ppu_event(&mapper.data);
+}
+
+// decoded instructions of the PRG window that contains addr (addr >= PRG_WINDOW_START)
+static inline DecodedInstruction*
+cartridge_decoded_window(u16 addr) {
+
+    MapperHeader* head = &mapper.data.head;
+    u32 window = (addr - PRG_WINDOW_START) / PRG_WINDOW_SIZE;
+
+    if(!head->decodedWindows[window]) {
+        u32 offset = mapper.cpu_prg_offset(&mapper.data, addr & ~(PRG_WINDOW_SIZE - 1));
+        if(offset == numeric_max_u32 || offset + PRG_WINDOW_SIZE > head->programMemoryLen) return NULL;
+        head->decodedWindows[window] = &head->decoded[offset];
+    }
+
+    return head->decodedWindows[window];
+}
+
 static char*
 cartridge_read_disassembly(u16 addr) {
 
@@ -208,4 +260,33 @@ cartridge_read_disassembly(u16 addr) {
         return err;
 }
 
+// 1 if cpu address starts a disassembly line, addresses outside PRG rom always do
+static u8
+cartridge_instruction_start(u16 addr) {
+
+    u32 offset = addr >= PRG_WINDOW_START ? mapper.cpu_prg_offset(&mapper.data, addr) : numeric_max_u32;
+    if(offset == numeric_max_u32 || offset >= mapper.data.head.programMemoryLen) return 1;
+    return mapperheader_instruction_start(&mapper.data.head, offset);
+}
+
+// label for cpu address found by the static disassembler, NULL if none
+static const char*
+cartridge_label(u16 addr, char* buffer) {
+
+    u32 offset = addr >= PRG_WINDOW_START ? mapper.cpu_prg_offset(&mapper.data, addr) : numeric_max_u32;
+    if(offset == numeric_max_u32 || offset >= mapper.data.head.programMemoryLen) return NULL;
+
+    CodeAnalysis* analysis = &mapper.data.head.analysis;
+    if(!analysis->starts) return NULL;
+
+    if(bitmap_get(analysis->subroutines, offset)) {
+        sprintf(buffer, "sub_%04X", addr);
+    } else if(bitmap_get(analysis->labels, offset)) {
+        sprintf(buffer, "L_%04X", addr);
+    } else {
+        return NULL;
+    }
+    return buffer;
+}
+
 #endif /* CARTRIDGE_H */
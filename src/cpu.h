@@ -8,6 +8,9 @@
 #include "defs.h"
 #include "cpudata.h"
 #include "bus.h"
+#include "trace.h"
+#include "profile.h"
+#include "breakpoint.h"
 // http://www.6502.org/tutorials/6502opcodes.html#ROR opcode explanations
 
 // Basicly 6502 cpu implementation
@@ -37,68 +40,184 @@ check_extra_cycle(Instructions opcode) {
     return extraCycleFlags & (/*(u64)1 << */opcode);
 }
 
+// Zero and Negative flags are evaluated lazily, instructions only store the
+// result byte and the flags are materialized when something actually reads them
+#define SET_ZN(VAL) (cpu.zeroResult = cpu.negativeResult = (u8)(VAL))
+
+// status reqister with Zero and Negative materialized (for pushes and debugger)
+static inline u8
+cpu_status() {
+    return (cpu.flags & ~(Zero | Negative)) |
+        (cpu.zeroResult == 0 ? Zero : 0) |
+        (cpu.negativeResult & Negative);
+}
+
+// loads hole status reqister (PLP, RTI, reset)
+static inline void
+cpu_status_set(u8 flags) {
+    cpu.flags = flags;
+    cpu.zeroResult = (flags & Zero) ? 0 : 1;
+    cpu.negativeResult = flags & Negative;
+}
+
+// branchless, Carry and Overflow are consumed right away by the next ADC/SBC/ROL
+// so there is nothing to gain from evaluating them lazily
 static inline void
 cpu_set_flag(CpuStatus flag,u8 cond) {
-    if(cond) {
-        cpu.flags |= flag;
-    } else {
-        cpu.flags &= ~flag;
-    }
+    cpu.flags = (cpu.flags & ~flag) | (-(u8)(cond != 0) & flag);
 }
 
 static inline u8
 cpu_get_flag(CpuStatus flag) {
-    return   (cpu.flags & flag) > 0;
+    return   (cpu_status() & flag) > 0;
 }
 
 
+// zero page addresses always land in cpu ram so they skip the bus
+#define IS_ZERO_PAGE_MODE(MODE) ((MODE) == ZP || (MODE) == ZPX || (MODE) == ZPY)
+
+// read and write watches, hooked is constant so this is compiled out of
+// everything but cpu_clock_hooked
+#define WATCH(BITMAP, KIND, VAL) do{                                    \
+    if(hooked && (breakpoints.watchedPages[addr >> 8] & (KIND)) &&      \
+            breakpoint_bit(breakpoints.BITMAP, addr))                   \
+    breakpoint_check(addr, (KIND), (VAL), cpu_status());                \
+} while(0)                                                              \
+
+// IMP, ACCUM and IMM have fetched value already set by the address mode
 #define FETCH do{                                                       \
-    if(instruct.addressMode != IMP && instruct.addressMode != ACCUM)    \
+    if(IS_ZERO_PAGE_MODE(instruct.addressMode))                         \
+    fetched = ram[addr];                                                \
+    else if(instruct.addressMode > IMM)                                 \
     fetched = bus_read8(addr);                                          \
+    if(instruct.addressMode > IMM) WATCH(read, BreakRead, fetched);     \
+} while(0)                                                              \
+
+#define STORE(VAL) do{                                                  \
+    WATCH(write, BreakWrite, (VAL));                                    \
+    if(IS_ZERO_PAGE_MODE(instruct.addressMode))                         \
+    ram[addr] = (VAL);                                                  \
+    else                                                                \
+    bus_write8(addr, (VAL));                                            \
 } while(0)                                                              \
 
 // https://wiki.nesdev.com/w/index.php/Stack
 // 6502 had a descending stack, with "empty stack" pointer (points to empty place)
-static inline void
-stack_push (u8 val) {
+// stack lives always in cpu ram page 1 so it is accessed directly, hooked
+// checks read and write watches on it like WATCH
+static FORCE_INLINE void
+stack_push (u8 val, u8 hooked) {
 
+#ifdef CPU_DEBUG
     if(cpu.stackPointer == 0) ABORT("stack overflow\n");
+#endif
 
-    bus_write8(STACK_START + cpu.stackPointer, val);
+    u16 addr = STACK_START + cpu.stackPointer;
+    WATCH(write, BreakWrite, val);
+    ram[addr] = val;
     cpu.stackPointer -= 1;
 }
 
-static inline u8
-stack_pop () {
+static FORCE_INLINE u8
+stack_pop (u8 hooked) {
 
+#ifdef CPU_DEBUG
     if(cpu.stackPointer == STACK_SIZE) ABORT("stack underflow");
+#endif
 
     cpu.stackPointer += 1;
-    return bus_read8(STACK_START + cpu.stackPointer);
+    u16 addr = STACK_START + cpu.stackPointer;
+    u8 val = ram[addr];
+    WATCH(read, BreakRead, val);
+    return val;
+}
+
+// decodes instruction through the bus
+static inline DecodedInstruction
+cpu_decode(u16 addr) {
+
+    u8 opcode = bus_read8(addr);
+    Instruction instruction = instructionTable[opcode];
+
+    DecodedInstruction ret = {
+        .operand = 0, .opcode = opcode, .instructionCode = instruction.instructionCode,
+        .addressMode = instruction.addressMode, .cycles = instruction.cycles,
+        .length = 1 + addressModeOperandBytes[instruction.addressMode]
+    };
+
+    if(ret.length == 2) {
+        ret.operand = bus_read8(addr + 1);
+    } else if(ret.length == 3) {
+        ret.operand = bus_read16(addr + 1);
+    }
+
+    return ret;
+}
+
+// Instructions in PRG rom are decoded once and cached per mapped PRG window,
+// code outside of PRG rom (ram, PRG ram) is decoded every time. Code is
+// marked to code/data log when decoded
+static inline DecodedInstruction
+cpu_fetch_instruction(u16 addr) {
+
+    if(addr >= PRG_WINDOW_START) {
+        DecodedInstruction* window = cartridge_decoded_window(addr);
+        if(window) {
+            DecodedInstruction* entry = &window[addr & (PRG_WINDOW_SIZE - 1)];
+            if(entry->length == 0) {
+                MapperHeader* head = &mapper.data.head;
+                u32 offset = (u32)(entry - head->decoded);
+                const u8* prg = &head->programMemory[offset];
+                Instruction instruction = instructionTable[prg[0]];
+
+                *entry = (DecodedInstruction) {
+                    .operand = 0, .opcode = prg[0], .instructionCode = instruction.instructionCode,
+                    .addressMode = instruction.addressMode, .cycles = instruction.cycles,
+                    .length = 1 + addressModeOperandBytes[instruction.addressMode]
+                };
+
+                // operand bytes continue in next window which might be some other bank
+                if((addr & (PRG_WINDOW_SIZE - 1)) + entry->length > PRG_WINDOW_SIZE) {
+                    entry->length = DECODED_UNCACHED;
+                } else {
+                    // read straight from PRG so code is not logged as data
+                    if(entry->length == 2) {
+                        entry->operand = prg[1];
+                    } else if(entry->length == 3) {
+                        entry->operand = prg[1] | (prg[2] << 8);
+                    }
+                    for(u32 i = 0; i < entry->length; i++) {
+                        head->prgCdl[offset + i] |= CdlCode | CDL_WINDOW(addr);
+                    }
+                }
+            }
+            if(entry->length != DECODED_UNCACHED) return *entry;
+        }
+    }
+    return cpu_decode(addr);
 }
 
 static void
 cpu_reset() {
 
     cpu = (cpu2ao3) {
-        .Xreq = 0, .Yreq = 0, .accumReq = 0, .flags = Unused, .pc = 0x0,
+        .Xreq = 0, .Yreq = 0, .accumReq = 0, .pc = 0x0,
             .stackPointer = STACK_SIZE, .cycles = 0
     };
+    // reset sets interrupt disable, APU frame IRQ is enabled at power on
+    cpu_status_set(Unused | DisableIterups);
 
     cpu.pc = bus_read16(PROGRAM_START_POINTER);
     cpu.cycles += 8;
 }
 
-static void
-cpu_iterrupt_request() { //irq
+static FORCE_INLINE void
+cpu_iterrupt_request(u8 hooked) { //irq
 
     if(cpu_get_flag(DisableIterups) == 0) {
         // write current pc to stack
-        stack_push( (cpu.pc >> 8) & 0xFF );
-        stack_push( cpu.pc & 0xFF );
-
-        // https://www.pagetable.com/?p=410
-        cpu_set_flag(DisableIterups, 1);
+        stack_push( (cpu.pc >> 8) & 0xFF, hooked );
+        stack_push( cpu.pc & 0xFF, hooked );
 
         //  op      Unused and Break    After push
         //  PHP     11                  None
@@ -106,10 +225,14 @@ cpu_iterrupt_request() { //irq
         //  IRQ     10                  Break is set to 1
         //  NMI     10                  Break is set to 1
 
-        cpu_set_flag(Break, 1); // TODO has to be set??
+        cpu_set_flag(Break, 0);
 
-        // TODO flags before or after?
-        stack_push(cpu.flags | Unused);
+        // status is pushed before interrupts are disabled so RTI enables them again
+        stack_push(cpu_status() | Unused, hooked);
+
+        // https://www.pagetable.com/?p=410
+        cpu_set_flag(DisableIterups, 1);
+        cpu_set_flag(Break, 1);
 
         // read new pc
         cpu.pc = bus_read16(IRQ_OR_BRK_PC_LOCATION);
@@ -118,8 +241,8 @@ cpu_iterrupt_request() { //irq
     }
 }
 
-static void
-cpu_no_mask_iterrupt() { //nmi
+static FORCE_INLINE void
+cpu_no_mask_iterrupt(u8 hooked) { //nmi
 
     //  op      Unused and Break    After push
     //  PHP     11                  None
@@ -127,16 +250,16 @@ cpu_no_mask_iterrupt() { //nmi
     //  IRQ     10                  Break is set to 1
     //  NMI     10                  Break is set to 1
 
-    stack_push( (cpu.pc >> 8) & 0xFF );
-    stack_push( cpu.pc & 0xFF );
-
-    // https://www.pagetable.com/?p=410
-    cpu_set_flag(DisableIterups, 1);
+    stack_push( (cpu.pc >> 8) & 0xFF, hooked );
+    stack_push( cpu.pc & 0xFF, hooked );
 
     cpu_set_flag(Break, 0); // TODO has to be set??
 
-    // TODO flags before or after?
-    stack_push(cpu.flags | Unused);
+    // status is pushed before interrupts are disabled so RTI enables them again
+    stack_push(cpu_status() | Unused, hooked);
+
+    // https://www.pagetable.com/?p=410
+    cpu_set_flag(DisableIterups, 1);
 
     cpu_set_flag(Break, 1); // TODO has to be set??
 
@@ -146,11 +269,11 @@ cpu_no_mask_iterrupt() { //nmi
     cpu.cycles = 8;
 }
 
-static void
-cpu_return_from_interrupt() { // RTI
-    cpu.flags = stack_pop();
-    u16 low = stack_pop();
-    u16 high = stack_pop();
+static FORCE_INLINE void
+cpu_return_from_interrupt(u8 hooked) { // RTI
+    cpu_status_set(stack_pop(hooked));
+    u16 low = stack_pop(hooked);
+    u16 high = stack_pop(hooked);
 
     cpu_set_flag(Break, 0);
     cpu_set_flag(Unused, 1); //TODO has to be set??
@@ -159,689 +282,704 @@ cpu_return_from_interrupt() { // RTI
 }
 
 
-int debug = 0;
-i32 breakpoint = 0x10000;
-u16 instructionCountBreakPoint = 0;
-static u8
-cpu_clock() {
+// executes already decoded instruction, pc has to point past the instruction
+// and cycles have to hold its base cycles. Forced inline so that callers with
+// constant instruction (jit.h) get the switches folded away, hooked enables
+// read and write watches
+static FORCE_INLINE void
+cpu_execute(DecodedInstruction instruct, u8 hooked) {
+
+    u16 operand = instruct.operand;
+    u16 addr = 0;
+    u8 fetched = 0;
+    // resolve the address from the operand
+    switch(instruct.addressMode) {
+        // http://www.emulator101.com/6502-addressing-modes.html
+        // first two are bit cryptic bit ACCUM might be accumulator address
+        // and https://github.com/OneLoneCoder/olcNES/blob/master/Part%232%20-%20CPU/olc6502.cpp
+        // used IMP as ACCUM equilevant
+        case IMP:
+            {
+                fetched = cpu.accumReq;
+            } break;
+        case ACCUM:
+            {
+                fetched = cpu.accumReq;
+                break;
+            } break;
+        case IMM:
+            {
+                // operand is the value itself, FETCH picks it up
+                fetched = (u8)operand;
+            } break;
+        case ZP: // zero page addressing
+            {
+                addr = operand;
+            } break;
+        case ZPX: // zero page addressing with x
+            {
+                addr = (operand + cpu.Xreq) % 256;
+            } break;
+        case ZPY: // zero page addressing with y
+            {
+                addr = (operand + cpu.Yreq) % 256;
+            } break;
+        case REL: // Branch instructions (e.g. BEQ, BCS) have a relative addressing mode
+            // that specifies an 8-bit signed offset relative to the current PC.
+            {
+                i8 rel = (i8)operand;
+                addr = rel + (cpu.pc);
+            }
+            break;
+        case ABS:
+            {
+                addr = operand;
+            } break;
+        case ABSX:
+            {
+                addr = operand;
+
+                // implement the oops cycle on page change
+                // https://wiki.nesdev.com/w/index.php/CPU_addressing_modes
+                u16 temp = addr + cpu.Xreq;
+                if( check_extra_cycle(instruct.instructionCode ) &&
+                        ((addr & 0xFF00) != (temp & 0xFF00))) {
+                    cpu.cycles += 1;
+                }
+                addr = temp;
+            } break;
+        case ABSY:
+            {
+                addr = operand;
+
+                // implement the oops cycle on page change
+                // https://wiki.nesdev.com/w/index.php/CPU_addressing_modes
+                u16 temp = addr + cpu.Yreq;
+                if( check_extra_cycle(instruct.instructionCode ) &&
+                        ((addr & 0xFF00) != (temp & 0xFF00)) ) {
+                    cpu.cycles += 1;
+                }
+                addr = temp;
+            } break;
+        case IND:  //  The JMP instruction has a special indirect addressing mode that can
+            // jump to the address stored in a 16-bit pointer anywhere in memory.
+            // this contains bug http://forum.6502.org/viewtopic.php?t=770
+            {
+                u16 low = operand & 0x00FF;
+                u16 high = operand >> 8;
+                u16 tempAddr = (high << 8) | low;
+
+                if (low == 0x00FF) { // Simulate page boundary hardware bug
+                    high = (tempAddr & 0xFF00);
+                    low = tempAddr;
+                } else {
+                    high = tempAddr + 1;
+                    low = tempAddr;
+                }
 
-    // execute the intruction
+                addr = (bus_read8(high) << 8) | bus_read8(low);
+            } break;
+        case INDX: // indirect zero page addressing with x
+            {
+                u16 ptr = operand;
 
-    u8 ret = cpu.cycles == 0;
+                u16 low = ram[(ptr + cpu.Xreq) & 0xFF];
+                u16 high = ram[(ptr + cpu.Xreq + 1) & 0xFF];
 
-    if(cpu.cycles == 0) {
+                addr = low | (high << 8);
 
-        u8 opcode = bus_read8(cpu.pc);
+            } break;
+        case INDY: // indirect zero page addressing with y
+            {
+                u16 ptr = operand;
 
-        // TODO remove all logs
-        CHECKLOG;
+                u16 low = ram[ptr & 0xFF];
+                u16 high = ram[(ptr + 1) & 0xFF];
 
-#ifdef LOGFILE
-        LOG("opcode 0x%04X pc 0x%04X accum 0x%04X, Yreq 0x%04X Xreq 0x%04X opcount %ld \n%s",
-                opcode, cpu.pc, cpu.accumReq, cpu.Yreq, cpu.Xreq, cpu.instructionCount,
-                cpuInstructionStrings[opcode]);
-#endif
+                addr = (low | (high << 8)) + cpu.Yreq;
 
-        cpu.pc += 1;
-
-        Instruction instruct = instructionTable[opcode];
-        cpu.cycles = instruct.cycles;
-
-        u16 addr = 0;
-        u8 fetched = 0;
-        // fetch required data
-        switch(instruct.addressMode) {
-            // http://www.emulator101.com/6502-addressing-modes.html
-            // first two are bit cryptic bit ACCUM might be accumulator address
-            // and https://github.com/OneLoneCoder/olcNES/blob/master/Part%232%20-%20CPU/olc6502.cpp
-            // used IMP as ACCUM equilevant
-            case IMP:
-                {
-                    fetched = cpu.accumReq;
-                } break;
-            case ACCUM:
-                {
-                    fetched = cpu.accumReq;
-                    break;
-                } break;
-            case IMM:
-                {
-                    addr = cpu.pc;
-                    cpu.pc++;
-                } break;
-            case ZP: // zero page addressing
-                {
-                    addr = bus_read8(cpu.pc);
-                    cpu.pc += 1;
-                } break;
-            case ZPX: // zero page addressing with x
-                {
-                    addr = (bus_read8(cpu.pc) + cpu.Xreq) % 256;
-                    cpu.pc += 1;
-                } break;
-            case ZPY: // zero page addressing with y
-                {
-                    addr = (bus_read8(cpu.pc) + cpu.Yreq) % 256;
-                    cpu.pc += 1;
-                } break;
-            case REL: // Branch instructions (e.g. BEQ, BCS) have a relative addressing mode
-                // that specifies an 8-bit signed offset relative to the current PC.
-                {
-                    i8 rel = (i8)bus_read8(cpu.pc);
-                    cpu.pc += 1;
-                    addr = rel + (cpu.pc);
+                // implement the oops cycle on page change
+                // https://wiki.nesdev.com/w/index.php/CPU_addressing_modes
+                if( check_extra_cycle(instruct.instructionCode ) &&
+                        ((addr & 0xFF00) != (high << 8)) ) {
+                    cpu.cycles += 1;
                 }
-                break;
-            case ABS:
-                {
-                    addr = bus_read16(cpu.pc);
-                    cpu.pc += 2;
-                } break;
-            case ABSX:
-                {
-                    addr = bus_read16(cpu.pc);
-                    cpu.pc += 2;
-
-                    // implement the oops cycle on page change
-                    // https://wiki.nesdev.com/w/index.php/CPU_addressing_modes
-                    u16 temp = addr + cpu.Xreq;
-                    if( check_extra_cycle(instruct.instructionCode ) &&
-                            ((addr & 0xFF00) != (temp & 0xFF00))) {
+            } break;
+        default:
+            ABORT("Error addressing mode");
+    }
+
+
+    // perform the instruction (this is hopefully optimized to jumptable)
+    switch(instruct.instructionCode) {
+
+        case ADC: //add with carry A + M + C -> A, C
+            {
+                FETCH;
+                //LOG("ADC accum 0x%04X, fetched 0x%04X, carry 0x%04X",
+                //cpu.accumReq, fetched, cpu_get_flag(Carry));
+                u16 temp = (u16)cpu.accumReq + (u16)fetched + (u16)cpu_get_flag(Carry);
+
+                cpu_set_flag(Carry, temp > 0xFF);
+                SET_ZN(temp & 0x00FF);
+
+                // check overflow
+                // (2 positives result negative) and (2 negatives result positive)
+                // so if two high bits are same on operants and different on result set it
+                cpu_set_flag(Overflow, (cpu.accumReq ^ (u8)(temp & 0x00FF)) &
+                        (fetched ^ (u8)(temp & 0x00FF)) & 0x80);
+
+                cpu.accumReq = temp & 0x00FF;
+            } break;
+        case AND: //and (with accumulator), A AND M -> A
+            {
+                FETCH;
+                cpu.accumReq &= fetched;
+
+                SET_ZN(cpu.accumReq);
+            } break;
+        case ASL: //arithmetic shift left, C <- [76543210] <- 0
+            {
+                FETCH;
+                u16 temp = ((u16)fetched) << 1;
+
+                SET_ZN(temp & 0xFF);
+                cpu_set_flag(Carry, (temp & 0x0100) > 0);
+
+                if(instruct.addressMode == IMP || instruct.addressMode == ACCUM) {
+                    cpu.accumReq = (u8)temp;
+                } else {
+                    STORE((u8)temp);
+                }
+            } break;
+        case BCC: //branch on carry clear
+            {
+                // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
+                // 1 cycle if same page 2 if different
+                if(cpu_get_flag(Carry) == 0) {
+                    cpu.cycles += 1;
+
+                    if((cpu.pc & 0xFF00) != (addr & 0xFF00)) { //TODO wtf
                         cpu.cycles += 1;
                     }
-                    addr = temp;
-                } break;
-            case ABSY:
-                {
-                    addr = bus_read16(cpu.pc);
-                    cpu.pc += 2;
-
-                    // implement the oops cycle on page change
-                    // https://wiki.nesdev.com/w/index.php/CPU_addressing_modes
-                    u16 temp = addr + cpu.Yreq;
-                    if( check_extra_cycle(instruct.instructionCode ) &&
-                            ((addr & 0xFF00) != (temp & 0xFF00)) ) {
+                    cpu.pc = addr;
+                }
+            } break;
+        case BCS: //branch on carry set
+            {
+                // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
+                // 1 cycle if same page 2 if different
+                if(cpu_get_flag(Carry) == 1) {
+                    cpu.cycles += 1;
+
+                    if((cpu.pc & 0xFF00) != (addr & 0xFF00)) { //TODO wtf
                         cpu.cycles += 1;
                     }
-                    addr = temp;
-                } break;
-            case IND:  //  The JMP instruction has a special indirect addressing mode that can
-                // jump to the address stored in a 16-bit pointer anywhere in memory.
-                // this contains bug http://forum.6502.org/viewtopic.php?t=770
-                {
-                    u16 low = (u16)bus_read8(cpu.pc);
-                    u16 high = (u16)bus_read8(cpu.pc + 1);
-                    u16 tempAddr = (high << 8) | low;
-
-                    if (low == 0x00FF) { // Simulate page boundary hardware bug
-                        high = (tempAddr & 0xFF00);
-                        low = tempAddr;
-                    } else {
-                        high = tempAddr + 1;
-                        low = tempAddr;
+                    cpu.pc = addr;
+                }
+            } break;
+        case BEQ: //branch on equal (zero set)
+            {
+                // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
+                // 1 cycle if same page 2 if different
+                if(cpu.zeroResult == 0) {
+                    cpu.cycles += 1;
+
+                    if((cpu.pc & 0xFF00) != (addr & 0xFF00)) { //TODO wtf
+                        cpu.cycles += 1;
                     }
-
-                    addr = (bus_read8(high) << 8) | bus_read8(low);
-                    cpu.pc += 2;
-                } break;
-            case INDX: // indirect zero page addressing with x
-                {
-                    u16 ptr = (u16)bus_read8(cpu.pc);
-
-                    u16 low = bus_read8((ptr + cpu.Xreq) & 0xFF);
-                    u16 high = bus_read8((ptr + cpu.Xreq + 1) & 0xFF);
-
-                    addr = low | (high << 8);
-
-                    cpu.pc += 1;
-
-                } break;
-            case INDY: // indirect zero page addressing with y
-                {
-                    u16 ptr = (u16)bus_read8(cpu.pc);
-
-                    u16 low = bus_read8(ptr & 0xFF); // TODO jotain on vaarin
-                    u16 high = bus_read8((ptr + 1) & 0xFF); // TODO jotain on vaarin
-
-                    addr = (low | (high << 8)) + cpu.Yreq;
-
-                    // implement the oops cycle on page change
-                    // https://wiki.nesdev.com/w/index.php/CPU_addressing_modes
-                    if( check_extra_cycle(instruct.instructionCode ) &&
-                            ((addr & 0xFF00) != (high << 8)) ) {
+                    cpu.pc = addr;
+                }
+            } break;
+        case BIT: // bit test, A AND M, M7 -> N, M6 -> V (V = overflow)
+            // bits 7 and 6 of operand are transfered to bit 7 and 6 of SR (N,V);
+            // the zeroflag is set to the result of operand AND accumulator.
+            {
+                FETCH;
+                // only instruction where Zero and Negative come from different values
+                cpu.zeroResult = cpu.accumReq & fetched;
+                cpu.negativeResult = fetched;
+                cpu_set_flag(Overflow, fetched & 0x40);
+            } break;
+        case BMI: //branch on minus (negative set)
+            {
+                // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
+                // 1 cycle if same page 2 if different
+                if(cpu.negativeResult & Negative) {
+                    cpu.cycles += 1;
+
+                    if((cpu.pc & 0xFF00) != (addr & 0xFF00)) {
                         cpu.cycles += 1;
                     }
-                    cpu.pc += 1;
-                } break;
-            default:
-                ABORT("Error addressing mode");
-        }
-
-
-        // perform the instruction (this is hopefully optimized to jumptable)
-        switch(instruct.instructionCode) {
+                    cpu.pc = addr;
+                }
+            } break;
+        case BNE: //branch on not equal (zero clear)
+            {
+                // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
+                // 1 cycle if same page 2 if different
+                if(cpu.zeroResult != 0) {
+                    cpu.cycles += 1;
+
+                    if((cpu.pc & 0xFF00) != (addr & 0xFF00)) {
+                        cpu.cycles += 1;
+                    }
+                    cpu.pc = addr;
+                }
+            } break;
+        case BPL: //branch on plus (negative clear)
+            {
+                // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
+                // 1 cycle if same page 2 if different
+                if(!(cpu.negativeResult & Negative)) {
+                    cpu.cycles += 1;
+
+                    if( (cpu.pc & 0xFF00) != (addr & 0xFF00) ) {
+                        cpu.cycles += 1;
+                    }
+                    cpu.pc = addr;
+                }
+            } break;
+        case BRK: //break interrupt, push PC+2, push SR
+            {
+                //  op      Unused and Break    After push
+                //  PHP     11                  None
+                //  BRK     11                  Break is set to 1
+                //  IRQ     10                  Break is set to 1
+                //  NMI     10                  Break is set to 1
+
+                stack_push( (cpu.pc >> 8) & 0xFF, hooked );
+                stack_push( cpu.pc & 0xFF, hooked );
+
+                cpu_set_flag(Break, 1);
+
+                stack_push(cpu_status() | Unused, hooked);
+
+                cpu.pc = bus_read16(IRQ_OR_BRK_PC_LOCATION);
+            } break;
+        case BVC: //branch on overflow clear
+            {
+                // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
+                // 1 cycle if same page 2 if different
+                if(cpu_get_flag(Overflow) == 0) {
+                    cpu.cycles += 1;
+
+                    if( (cpu.pc & 0xFF00) != (addr & 0xFF00) ) {
+                        cpu.cycles += 1;
+                    }
+                    cpu.pc = addr;
+                }
+            } break;
+        case BVS: //branch on overflow set
+            {
+                // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
+                // 1 cycle if same page 2 if different
+                if(cpu_get_flag(Overflow) == 1) {
+                    cpu.cycles += 1;
+
+                    if( (cpu.pc & 0xFF00) != (addr & 0xFF00) ) {
+                        cpu.cycles += 1;
+                    }
+                    cpu.pc = addr;
+                }
+            } break;
+        case CLC: //clear carry
+            {
+                cpu_set_flag(Carry, 0);
+            } break;
+        case CLD: //clear decimal
+            {
+                cpu_set_flag(DecimalMode, 0);
+                // might happen on some tests
+                //ABORT("Decimal clearing should not happen");
+            } break;
+        case CLI: //clear interrupt disable
+            {
+                cpu_set_flag(DisableIterups, 0);
+            } break;
+        case CLV: //clear overflow
+            {
+                cpu_set_flag(Overflow, 0);
+            } break;
+        case CMP: //compare (with accumulator) A - M
+            {
+                FETCH;
+                u16 temp = (u16)cpu.accumReq - (u16)fetched;
+
+                cpu_set_flag(Carry, cpu.accumReq >= fetched);
+                SET_ZN(temp & 0x00FF);
+            } break;
+        case CPX: //compare with X - M
+            {
+                FETCH;
+                u8 temp = (u16)cpu.Xreq - (u16)fetched;
+                cpu_set_flag(Carry, cpu.Xreq >= fetched);
+                SET_ZN(temp & 0x00FF);
+            } break;
+        case CPY: //compare with Y, Y - M
+            {
+                FETCH;
+                u8 temp = (u16)cpu.Yreq - (u16)fetched;
+                cpu_set_flag(Carry, cpu.Yreq >= fetched);
+                SET_ZN(temp & 0x00FF);
+            } break;
+        case DEC: //decrement, M - 1 -> M or (A - 1 ?? TODO)
+            {
+                FETCH;
+                u16 temp = fetched - 1;
+                SET_ZN(temp & 0x00FF);
+                STORE(temp & 0x00FF);
+            } break;
+        case DEX: //decrement X, X - 1 -> X
+            {
+                cpu.Xreq -= 1;
+                SET_ZN(cpu.Xreq);
+            } break;
+        case DEY: //decrement Y, Y - 1 -> Y
+            {
+                cpu.Yreq -= 1;
+                SET_ZN(cpu.Yreq);
+            } break;
+        case EOR: //exclusive or (with accumulator), A EOR M -> A
+            {
+                FETCH;
+                cpu.accumReq = cpu.accumReq ^ fetched;
+                SET_ZN(cpu.accumReq);
+            } break;
+        case INC: //increment M + 1 -> M (A - 1 -> A ??TODO)
+            {
+                FETCH;
+                u16 temp = (u16)fetched + 1;
+                STORE(temp & 0x00FF);
+
+                SET_ZN(temp & 0xFF);
+            } break;
+        case INX: //increment X, X + 1 -> X
+            {
+                cpu.Xreq += 1;
+
+                SET_ZN(cpu.Xreq);
+            } break;
+        case INY: //increment Y, Y + 1 -> Y
+            {
+                cpu.Yreq += 1;
+
+                SET_ZN(cpu.Yreq);
+            } break;
+        case JMP: //jump  (PC+1) -> PCL    (PC+2) -> PCH
+            {
+                cpu.pc = addr;
+            } break;
+        case JSR: //jump subroutine
+            {
+                // our actual instruction
+                cpu.pc -= 1;
+
+                //stack_push(cpu.pc);
+
+                // push pc
+                stack_push( (cpu.pc >> 8) & 0x00FF, hooked );
+                stack_push( cpu.pc & 0x00FF, hooked );
+
+                cpu.pc = addr;
+            } break;
+        case LDA: //load accumulator, M -> A
+            {
+                FETCH;
+                cpu.accumReq = fetched;
+
+                SET_ZN(cpu.accumReq);
+            } break;
+        case LDX: //load X
+            {
+                FETCH;
+                cpu.Xreq = fetched;
+
+                SET_ZN(cpu.Xreq);
+            } break;
+        case LDY: //load Y
+            {
+                FETCH;
+                //LOG("LDY Y req 0x%04X Fetched 0x%04X flags 0x%04X", cpu.Yreq, fetched, cpu.flags);
+                cpu.Yreq = fetched;
+
+                SET_ZN(cpu.Yreq);
+
+                //LOG("flags 0x%04X", cpu.flags);
+            } break;
+        case LSR: //logical shift right, 0 -> [76543210] -> C
+            {
+                FETCH;
+                u8 temp = fetched >> 1;
+                cpu_set_flag(Carry, fetched & 0x1);
+                SET_ZN(temp);
+
+
+                if(instruct.addressMode == IMP || instruct.addressMode == ACCUM) {
+                    cpu.accumReq = temp;
+                } else {
+                    STORE(temp);
+                }
 
-            case ADC: //add with carry A + M + C -> A, C
-                {
-                    FETCH;
-                    //LOG("ADC accum 0x%04X, fetched 0x%04X, carry 0x%04X",
-                    //cpu.accumReq, fetched, cpu_get_flag(Carry));
-                    u16 temp = (u16)cpu.accumReq + (u16)fetched + (u16)cpu_get_flag(Carry);
+            } break;
+        case NOP: //no operation
+            {
+                // TODO
+                //ABORT("not legal instruction (NOP TODO implementation)");
+            } break;
+        case ORA: //or with accumulator,  A OR M -> A
+            {
+                FETCH;
+                cpu.accumReq |= fetched;
+
+                SET_ZN(cpu.accumReq);
+            } break;
+        case PHA: //push accumulator
+            {
+                stack_push(cpu.accumReq, hooked);
+            } break;
+        case PHP: //push processor status (SR)
+            {
+                // In the byte pushed, bit 5 is always set to 1,
+                // and bit 4 is 1 if from an instruction (PHP or BRK)
+
+                //  op      Unused and Break    After push
+                //  PHP     11                  None
+                //  BRK     11                  Break is set to 1
+                //  IRQ     10                  Break is set to 1
+                //  NMI     10                  Break is set to 1
+
+                stack_push(cpu_status() | Break | Unused, hooked);
+
+                cpu_set_flag(Break, 0);
+                //cpu_set_flag(Unused, 0); // TODO
+            } break;
+        case PLA: //pull accumulator
+            {
+                cpu.accumReq = stack_pop(hooked);
+                SET_ZN(cpu.accumReq);
+            } break;
+        case PLP: //pull processor status (SR)
+            {
+                cpu_status_set(stack_pop(hooked));
+            } break;
+        case ROL: //rotate left,  C <- [76543210] <- C (M or A)
+            {
+                FETCH;
+
+                //LOG("ROL fetched 0x%04X carry 0x%04X", fetched, cpu_get_flag(Carry));
+
+                u16 temp = (u16)((fetched << 1) | cpu_get_flag(Carry));
+
+                SET_ZN(temp & 0x00FF);
+                cpu_set_flag(Carry, (temp & 0xFF00) > 0);
+
+                if(instruct.addressMode == IMP || instruct.addressMode == ACCUM) {
+                    cpu.accumReq = temp & 0x00FF;
+                } else {
+                    STORE(temp & 0x00FF);
+                }
 
-                    cpu_set_flag(Carry, temp > 0xFF);
-                    cpu_set_flag(Zero, (temp & 0x00FF) == 0x0);
-                    cpu_set_flag(Negative, temp & 0x80);
+            } break;
+        case ROR: //rotate right, C -> [76543210] -> C
+            {
+                FETCH;
+                u16 temp = (u16)((fetched >> 1) | (cpu_get_flag(Carry) << 7));
 
-                    // check overflow
-                    // (2 positives result negative) and (2 negatives result positive)
-                    // so if two high bits are same on operants and different on result set it
-                    cpu_set_flag(Overflow, (cpu.accumReq ^ (u8)(temp & 0x00FF)) &
-                            (fetched ^ (u8)(temp & 0x00FF)) & 0x80);
+                SET_ZN(temp & 0x00FF);
+                cpu_set_flag(Carry, fetched & 0x1);
 
+                if(instruct.addressMode == IMP || instruct.addressMode == ACCUM) {
                     cpu.accumReq = temp & 0x00FF;
-                } break;
-            case AND: //and (with accumulator), A AND M -> A
-                {
-                    FETCH;
-                    cpu.accumReq &= fetched;
-
-                    cpu_set_flag(Negative, cpu.accumReq & 0x80);
-                    cpu_set_flag(Zero, cpu.accumReq == 0);
-                } break;
-            case ASL: //arithmetic shift left, C <- [76543210] <- 0
-                {
-                    FETCH;
-                    u16 temp = ((u16)fetched) << 1;
-
-                    cpu_set_flag(Negative, temp & 0x80);
-                    cpu_set_flag(Zero, (temp & 0xFF) == 0);
-                    cpu_set_flag(Carry, (temp & 0x0100) > 0);
-
-                    if(instruct.addressMode == IMP || instruct.addressMode == ACCUM) {
-                        cpu.accumReq = (u8)temp;
-                    } else {
-                        bus_write8(addr, (u8)temp);
-                    }
-                } break;
-            case BCC: //branch on carry clear
-                {
-                    // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
-                    // 1 cycle if same page 2 if different
-                    if(cpu_get_flag(Carry) == 0) {
-                        cpu.cycles += 1;
+                } else {
+                    STORE(temp & 0x00FF);
+                }
 
-                        if((cpu.pc & 0xFF00) != (addr & 0xFF00)) { //TODO wtf
-                            cpu.cycles += 1;
-                        }
-                        cpu.pc = addr;
-                    }
-                } break;
-            case BCS: //branch on carry set
-                {
-                    // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
-                    // 1 cycle if same page 2 if different
-                    if(cpu_get_flag(Carry) == 1) {
-                        cpu.cycles += 1;
+            } break;
+        case RTI: //return from interrupt
+            {
+                cpu_return_from_interrupt(hooked);
+            } break;
+        case RTS: //return from subroutine
+            {
+                u16 low = stack_pop(hooked);
+                u16 high = stack_pop(hooked);
+                cpu.pc = low | (high << 8);
+                cpu.pc += 1;
+            } break;
+        case SBC: //subtract with carry, A - M - (1 - C) -> A (1 - C is borrow bit)
+            {
+                // same as ADC but with inverted M
+                FETCH;
+
+                fetched ^= 0xFF;
+
+                // TODO fix
+                u16 temp = (u16)cpu.accumReq + (u16)fetched + (u16)cpu_get_flag(Carry);
+
+                cpu_set_flag(Carry, temp > 0xFF);
+                SET_ZN(temp & 0x00FF);
+
+                // check overflow
+                // (2 positives result negative) and (2 negatives result positive)
+                // so if two high bits are same on operants and different on result set it
+
+                // TODO check
+                cpu_set_flag(Overflow, (cpu.accumReq ^ (u8)(temp & 0x00FF)) &
+                        (fetched ^ (u8)(temp & 0x00FF)) & 0x80);
+
+                cpu.accumReq = temp & 0x00FF;
+
+            } break;
+        case SEC: //set carry
+            {
+                cpu_set_flag(Carry, 1);
+            } break;
+        case SED: //set decimal
+            {
+                cpu_set_flag(DecimalMode, 1);
+                //ABORT("Set decimal should not be called!");
+            } break;
+        case SEI: //set interrupt disable
+            {
+                cpu_set_flag(DisableIterups, 1);
+            } break;
+        case STA: //store accumulator,  A -> M
+            {
+                STORE(cpu.accumReq);
+            } break;
+        case STX: //store X, X -> M
+            {
+                STORE(cpu.Xreq);
+            } break;
+        case STY: //store Y, Y -> M
+            {
+                STORE(cpu.Yreq);
+            } break;
+        case TAX: //transfer accumulator to X, A -> X
+            {
+                cpu.Xreq = cpu.accumReq;
+                SET_ZN(cpu.Xreq);
+            } break;
+        case TAY: //transfer accumulator to Y, A -> Y
+            {
+                cpu.Yreq = cpu.accumReq;
+                SET_ZN(cpu.Yreq);
+            } break;
+        case TSX: //transfer stack pointer to X
+            {
+                cpu.Xreq = cpu.stackPointer;
+                SET_ZN(cpu.Xreq);
+            } break;
+        case TXA: //transfer X to accumulator, X -> A
+            {
+                cpu.accumReq = cpu.Xreq;
+                SET_ZN(cpu.accumReq);
+            } break;
+        case TXS: //transfer X to stack pointer, X -> SP
+            {
+                //LOG("TXS stack pointer 0x%04x xreq 0x%04x", cpu.stackPointer, cpu.Xreq);
+                cpu.stackPointer = cpu.Xreq;
+            } break;
+        case TYA: //transfer Y to accumulator, Y -> A
+            {
+                cpu.accumReq = cpu.Yreq;
+                SET_ZN(cpu.accumReq);
+            } break;
+        case XXX: // Unknown
+            {
+                ABORT("not legal instruction");
+            } break;
+        default:
+            {
+                ABORT("Unknown instruction");
+            }
+    }
+}
 
-                        if((cpu.pc & 0xFF00) != (addr & 0xFF00)) { //TODO wtf
-                            cpu.cycles += 1;
-                        }
-                        cpu.pc = addr;
-                    }
-                } break;
-            case BEQ: //branch on equal (zero set)
-                {
-                    // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
-                    // 1 cycle if same page 2 if different
-                    if(cpu_get_flag(Zero) == 1) {
-                        cpu.cycles += 1;
 
-                        if((cpu.pc & 0xFF00) != (addr & 0xFF00)) { //TODO wtf
-                            cpu.cycles += 1;
-                        }
-                        cpu.pc = addr;
-                    }
-                } break;
-            case BIT: // bit test, A AND M, M7 -> N, M6 -> V (V = overflow)
-                // bits 7 and 6 of operand are transfered to bit 7 and 6 of SR (N,V);
-                // the zeroflag is set to the result of operand AND accumulator.
-                {
-                    FETCH;
-                    u8 temp = cpu.accumReq & fetched;
-                    cpu_set_flag(Negative, fetched & 0x80);
-                    cpu_set_flag(Overflow, fetched & 0x40);
-                    cpu_set_flag(Zero, temp == 0x0);
-                } break;
-            case BMI: //branch on minus (negative set)
-                {
-                    // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
-                    // 1 cycle if same page 2 if different
-                    if(cpu_get_flag(Negative) == 1) {
-                        cpu.cycles += 1;
+int debug = 0;
 
-                        if((cpu.pc & 0xFF00) != (addr & 0xFF00)) {
-                            cpu.cycles += 1;
-                        }
-                        cpu.pc = addr;
-                    }
-                } break;
-            case BNE: //branch on not equal (zero clear)
-                {
-                    // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
-                    // 1 cycle if same page 2 if different
-                    if(cpu_get_flag(Zero) == 0) {
-                        cpu.cycles += 1;
+// how the cpu runs PRG rom code, blocks are only used while running freely
+typedef enum CpuEngine {
+    CPU_INTERPRETER = 0,
+    CPU_JIT,                // compiled blocks, see jit.h
+    CPU_JIT_DIFFERENTIAL,   // compiled blocks checked against interpreter
+    CPU_THREADED,           // pre translated handler streams, see threaded.h
+} CpuEngine;
 
-                        if((cpu.pc & 0xFF00) != (addr & 0xFF00)) {
-                            cpu.cycles += 1;
-                        }
-                        cpu.pc = addr;
-                    }
-                } break;
-            case BPL: //branch on plus (negative clear)
-                {
-                    // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
-                    // 1 cycle if same page 2 if different
-                    if(cpu_get_flag(Negative) == 0) {
-                        cpu.cycles += 1;
+CpuEngine cpuEngine = CPU_INTERPRETER;
 
-                        if( (cpu.pc & 0xFF00) != (addr & 0xFF00) ) {
-                            cpu.cycles += 1;
-                        }
-                        cpu.pc = addr;
-                    }
-                } break;
-            case BRK: //break interrupt, push PC+2, push SR
-                {
-                    //  op      Unused and Break    After push
-                    //  PHP     11                  None
-                    //  BRK     11                  Break is set to 1
-                    //  IRQ     10                  Break is set to 1
-                    //  NMI     10                  Break is set to 1
-
-                    stack_push( (cpu.pc >> 8) & 0xFF );
-                    stack_push( cpu.pc & 0xFF );
-
-                    cpu_set_flag(Break, 1);
-
-                    stack_push(cpu.flags | Unused);
-
-                    cpu.pc = bus_read16(IRQ_OR_BRK_PC_LOCATION);
-                } break;
-            case BVC: //branch on overflow clear
-                {
-                    // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
-                    // 1 cycle if same page 2 if different
-                    if(cpu_get_flag(Overflow) == 0) {
-                        cpu.cycles += 1;
+// jit.h
+static u8 jit_run_block();
+// threaded.h
+static u8 threaded_run();
 
-                        if( (cpu.pc & 0xFF00) != (addr & 0xFF00) ) {
-                            cpu.cycles += 1;
-                        }
-                        cpu.pc = addr;
-                    }
-                } break;
-            case BVS: //branch on overflow set
-                {
-                    // http://archive.6502.org/datasheets/rockwell_r65c00_microprocessors.pdf
-                    // 1 cycle if same page 2 if different
-                    if(cpu_get_flag(Overflow) == 1) {
-                        cpu.cycles += 1;
+// trace, profiler or breakpoints need cpu_clock_hooked
+static inline u8
+cpu_hooks_active() {
+    return trace.enabled || profile.enabled || breakpoints.count > 0;
+}
 
-                        if( (cpu.pc & 0xFF00) != (addr & 0xFF00) ) {
-                            cpu.cycles += 1;
-                        }
-                        cpu.pc = addr;
-                    }
-                } break;
-            case CLC: //clear carry
-                {
-                    cpu_set_flag(Carry, 0);
-                } break;
-            case CLD: //clear decimal
-                {
-                    cpu_set_flag(DecimalMode, 0);
-                    // might happen on some tests
-                    //ABORT("Decimal clearing should not happen");
-                } break;
-            case CLI: //clear interrupt disable
-                {
-                    cpu_set_flag(DisableIterups, 0);
-                } break;
-            case CLV: //clear overflow
-                {
-                    cpu_set_flag(Overflow, 0);
-                } break;
-            case CMP: //compare (with accumulator) A - M
-                {
-                    FETCH;
-                    u16 temp = (u16)cpu.accumReq - (u16)fetched;
-
-                    cpu_set_flag(Carry, cpu.accumReq >= fetched);
-                    cpu_set_flag(Negative, temp  & 0x0080);
-                    cpu_set_flag(Zero, (temp & 0x00FF) == 0x0);
-                } break;
-            case CPX: //compare with X - M
-                {
-                    FETCH;
-                    u8 temp = (u16)cpu.Xreq - (u16)fetched;
-                    cpu_set_flag(Carry, cpu.Xreq >= fetched);
-                    cpu_set_flag(Negative, temp  & 0x0080);
-                    cpu_set_flag(Zero, (temp & 0x00FF) == 0x0);
-                } break;
-            case CPY: //compare with Y, Y - M
-                {
-                    FETCH;
-                    u8 temp = (u16)cpu.Yreq - (u16)fetched;
-                    cpu_set_flag(Carry, cpu.Yreq >= fetched);
-                    cpu_set_flag(Negative, temp  & 0x0080);
-                    cpu_set_flag(Zero, (temp & 0x00FF) == 0x0);
-                } break;
-            case DEC: //decrement, M - 1 -> M or (A - 1 ?? TODO)
-                {
-                    FETCH;
-                    u16 temp = fetched - 1;
-                    cpu_set_flag(Negative, temp & 0x80);
-                    cpu_set_flag(Zero, (temp & 0x00FF) == 0);
-                    bus_write8(addr, temp & 0x00FF);
-                } break;
-            case DEX: //decrement X, X - 1 -> X
-                {
-                    cpu.Xreq -= 1;
-                    cpu_set_flag(Negative, cpu.Xreq & 0x80);
-                    cpu_set_flag(Zero, cpu.Xreq == 0x0);
-                } break;
-            case DEY: //decrement Y, Y - 1 -> Y
-                {
-                    cpu.Yreq -= 1;
-                    cpu_set_flag(Negative, cpu.Yreq & 0x80);
-                    cpu_set_flag(Zero, cpu.Yreq == 0x0);
-                } break;
-            case EOR: //exclusive or (with accumulator), A EOR M -> A
-                {
-                    FETCH;
-                    cpu.accumReq = cpu.accumReq ^ fetched;
-                    cpu_set_flag(Negative, cpu.accumReq & 0x80);
-                    cpu_set_flag(Zero, cpu.accumReq == 0x0);
-                } break;
-            case INC: //increment M + 1 -> M (A - 1 -> A ??TODO)
-                {
-                    FETCH;
-                    u16 temp = (u16)fetched + 1;
-                    bus_write8(addr, temp & 0x00FF);
-
-                    cpu_set_flag(Negative, temp & 0x0080);
-                    cpu_set_flag(Zero, (temp & 0xFF) == 0x0);
-                } break;
-            case INX: //increment X, X + 1 -> X
-                {
-                    cpu.Xreq += 1;
-
-                    cpu_set_flag(Negative, cpu.Xreq & 0x0080);
-                    cpu_set_flag(Zero, cpu.Xreq == 0x0);
-                } break;
-            case INY: //increment Y, Y + 1 -> Y
-                {
-                    cpu.Yreq += 1;
-
-                    cpu_set_flag(Negative, cpu.Yreq & 0x0080);
-                    cpu_set_flag(Zero, cpu.Yreq == 0x0);
-                } break;
-            case JMP: //jump  (PC+1) -> PCL    (PC+2) -> PCH
-                {
-                    cpu.pc = addr;
-                } break;
-            case JSR: //jump subroutine
-                {
-                    // our actual instruction
-                    cpu.pc -= 1;
+// hooked is constant in both variants below, cpu_clock has no checks for
+// trace, profiler or breakpoints and cpu_clock_hooked never runs blocks
+static FORCE_INLINE u8
+cpu_clock_variant(u8 hooked) {
 
-                    //stack_push(cpu.pc);
+    // execute the intruction
 
-                    // push pc
-                    stack_push( (cpu.pc >> 8) & 0x00FF );
-                    stack_push( cpu.pc & 0x00FF );
+    u8 ret = cpu.cycles == 0;
 
-                    cpu.pc = addr;
-                } break;
-            case LDA: //load accumulator, M -> A
-                {
-                    FETCH;
-                    cpu.accumReq = fetched;
-
-                    cpu_set_flag(Negative, cpu.accumReq & 0x0080);
-                    cpu_set_flag(Zero, cpu.accumReq == 0x0);
-                } break;
-            case LDX: //load X
-                {
-                    FETCH;
-                    cpu.Xreq = fetched;
-
-                    cpu_set_flag(Negative, cpu.Xreq & 0x0080);
-                    cpu_set_flag(Zero, cpu.Xreq == 0x0);
-                } break;
-            case LDY: //load Y
-                {
-                    FETCH;
-                    //LOG("LDY Y req 0x%04X Fetched 0x%04X flags 0x%04X", cpu.Yreq, fetched, cpu.flags);
-                    cpu.Yreq = fetched;
-
-                    cpu_set_flag(Negative, cpu.Yreq & 0x0080);
-                    cpu_set_flag(Zero, cpu.Yreq == 0x0);
-
-                    //LOG("flags 0x%04X", cpu.flags);
-                } break;
-            case LSR: //logical shift right, 0 -> [76543210] -> C
-                {
-                    FETCH;
-                    u8 temp = fetched >> 1;
-                    cpu_set_flag(Carry, fetched & 0x1);
-                    cpu_set_flag(Negative, 0);
-                    cpu_set_flag(Zero, temp == 0x0);
-
-
-                    if(instruct.addressMode == IMP || instruct.addressMode == ACCUM) {
-                        cpu.accumReq = temp;
-                    } else {
-                        bus_write8(addr, temp);
-                    }
+    if(cpu.cycles == 0) {
 
-                } break;
-            case NOP: //no operation
-                {
-                    // TODO
-                    //ABORT("not legal instruction (NOP TODO implementation)");
-                } break;
-            case ORA: //or with accumulator,  A OR M -> A
-                {
-                    FETCH;
-                    cpu.accumReq |= fetched;
-
-                    cpu_set_flag(Negative, cpu.accumReq & 0x0080);
-                    cpu_set_flag(Zero, cpu.accumReq == 0x0);
-                } break;
-            case PHA: //push accumulator
-                {
-                    stack_push(cpu.accumReq);
-                } break;
-            case PHP: //push processor status (SR)
-                {
-                    // In the byte pushed, bit 5 is always set to 1,
-                    // and bit 4 is 1 if from an instruction (PHP or BRK)
-
-                    //  op      Unused and Break    After push
-                    //  PHP     11                  None
-                    //  BRK     11                  Break is set to 1
-                    //  IRQ     10                  Break is set to 1
-                    //  NMI     10                  Break is set to 1
-
-                    stack_push(cpu.flags | Break | Unused);
-
-                    cpu_set_flag(Break, 0);
-                    //cpu_set_flag(Unused, 0); // TODO
-                } break;
-            case PLA: //pull accumulator
-                {
-                    cpu.accumReq = stack_pop();
-                    cpu_set_flag(Negative, cpu.accumReq & 0x80);
-                    cpu_set_flag(Zero, cpu.accumReq == 0x0);
-                } break;
-            case PLP: //pull processor status (SR)
-                {
-                    cpu.flags = stack_pop();
-                } break;
-            case ROL: //rotate left,  C <- [76543210] <- C (M or A)
-                {
-                    FETCH;
-
-                    //LOG("ROL fetched 0x%04X carry 0x%04X", fetched, cpu_get_flag(Carry));
-
-                    u16 temp = (u16)((fetched << 1) | cpu_get_flag(Carry));
-
-                    cpu_set_flag(Negative, temp & 0x0080);
-                    cpu_set_flag(Zero, (temp & 0x00FF) == 0x0);
-                    cpu_set_flag(Carry, (temp & 0xFF00) > 0);
-
-                    if(instruct.addressMode == IMP || instruct.addressMode == ACCUM) {
-                        cpu.accumReq = temp & 0x00FF;
-                    } else {
-                        bus_write8(addr, temp & 0x00FF);
-                    }
+        if(cpu.irqLines && !(cpu.flags & DisableIterups)) {
+            cpu_iterrupt_request(hooked);
+        } else {
+            u8 ranBlock = !hooked && cpuEngine != CPU_INTERPRETER &&
+                (cpuEngine == CPU_THREADED ? threaded_run() : jit_run_block());
 
-                } break;
-            case ROR: //rotate right, C -> [76543210] -> C
-                {
-                    FETCH;
-                    u16 temp = (u16)((fetched >> 1) | (cpu_get_flag(Carry) << 7));
+            if(!ranBlock) {
+                DecodedInstruction instruct = cpu_fetch_instruction(cpu.pc);
 
-                    cpu_set_flag(Negative, temp & 0x0080);
-                    cpu_set_flag(Zero, (temp & 0x00FF) == 0x0);
-                    cpu_set_flag(Carry, fetched & 0x1);
+                if(hooked && trace.enabled) trace_record(&instruct, cpu_status());
 
-                    if(instruct.addressMode == IMP || instruct.addressMode == ACCUM) {
-                        cpu.accumReq = temp & 0x00FF;
-                    } else {
-                        bus_write8(addr, temp & 0x00FF);
-                    }
+                u16 pc = cpu.pc;
+                cpu.pc += instruct.length;
+                cpu.cycles = instruct.cycles;
 
-                } break;
-            case RTI: //return from interrupt
-                {
-                    cpu_return_from_interrupt();
-                } break;
-            case RTS: //return from subroutine
-                {
-                    u16 low = stack_pop();
-                    u16 high = stack_pop();
-                    cpu.pc = low | (high << 8);
-                    cpu.pc += 1;
-                } break;
-            case SBC: //subtract with carry, A - M - (1 - C) -> A (1 - C is borrow bit)
-                {
-                    // same as ADC but with inverted M
-                    FETCH;
-
-                    fetched ^= 0xFF;
-
-                    // TODO fix
-                    u16 temp = (u16)cpu.accumReq + (u16)fetched + (u16)cpu_get_flag(Carry);
-
-                    cpu_set_flag(Carry, temp > 0xFF);
-                    cpu_set_flag(Zero, (temp & 0x00FF) == 0x0);
-                    cpu_set_flag(Negative, (temp & 0x80) == 0x80);
-
-                    // check overflow
-                    // (2 positives result negative) and (2 negatives result positive)
-                    // so if two high bits are same on operants and different on result set it
-
-                    // TODO check
-                    cpu_set_flag(Overflow, (cpu.accumReq ^ (u8)(temp & 0x00FF)) &
-                            (fetched ^ (u8)(temp & 0x00FF)) & 0x80);
+                cpu_execute(instruct, hooked);
 
-                    cpu.accumReq = temp & 0x00FF;
+                if(hooked && profile.enabled) profile_record(pc, &instruct);
 
-                } break;
-            case SEC: //set carry
-                {
-                    cpu_set_flag(Carry, 1);
-                } break;
-            case SED: //set decimal
-                {
-                    cpu_set_flag(DecimalMode, 1);
-                    //ABORT("Set decimal should not be called!");
-                } break;
-            case SEI: //set interrupt disable
-                {
-                    cpu_set_flag(DisableIterups, 1);
-                } break;
-            case STA: //store accumulator,  A -> M
-                {
-                    bus_write8(addr, cpu.accumReq);
-                } break;
-            case STX: //store X, X -> M
-                {
-                    bus_write8(addr, cpu.Xreq);
-                } break;
-            case STY: //store Y, Y -> M
-                {
-                    bus_write8(addr, cpu.Yreq);
-                } break;
-            case TAX: //transfer accumulator to X, A -> X
-                {
-                    cpu.Xreq = cpu.accumReq;
-                    cpu_set_flag(Negative, cpu.Xreq & 0x80);
-                    cpu_set_flag(Zero, cpu.Xreq == 0x0);
-                } break;
-            case TAY: //transfer accumulator to Y, A -> Y
-                {
-                    cpu.Yreq = cpu.accumReq;
-                    cpu_set_flag(Negative, cpu.Yreq & 0x80);
-                    cpu_set_flag(Zero, cpu.Yreq == 0x0);
-                } break;
-            case TSX: //transfer stack pointer to X
-                {
-                    cpu.Xreq = cpu.stackPointer;
-                    cpu_set_flag(Negative, cpu.Xreq & 0x80);
-                    cpu_set_flag(Zero, cpu.Xreq == 0x0);
-                } break;
-            case TXA: //transfer X to accumulator, X -> A
-                {
-                    cpu.accumReq = cpu.Xreq;
-                    cpu_set_flag(Negative, cpu.accumReq & 0x80);
-                    cpu_set_flag(Zero, cpu.accumReq == 0x0);
-                } break;
-            case TXS: //transfer X to stack pointer, X -> SP
-                {
-                    //LOG("TXS stack pointer 0x%04x xreq 0x%04x", cpu.stackPointer, cpu.Xreq);
-                    cpu.stackPointer = cpu.Xreq;
-                } break;
-            case TYA: //transfer Y to accumulator, Y -> A
-                {
-                    cpu.accumReq = cpu.Yreq;
-                    cpu_set_flag(Negative, cpu.accumReq & 0x80);
-                    cpu_set_flag(Zero, cpu.accumReq == 0x0);
-                } break;
-            case XXX: // Unknown
-                {
-                    ABORT("not legal instruction");
-                } break;
-            default:
-                {
-                    ABORT("Unknown instruction");
-                }
+                cpu.instructionCount++;
+            }
         }
-        cpu.instructionCount++;
 
-        if(cpu.pc == breakpoint || cpu.instructionCount == instructionCountBreakPoint) {
-            LOG("breakpoint! %d %d", cpu.instructionCount, instructionCountBreakPoint);
+        if(hooked && breakpoint_bit(breakpoints.execute, cpu.pc)) {
+            breakpoint_check(cpu.pc, BreakExecute, 0, cpu_status());
+        }
+        if(hooked && breakpoints.hit) {
+            LOG("breakpoint at 0x%04X, pc 0x%04X instruction %ld", breakpoints.hitAddr,
+                    cpu.pc, cpu.instructionCount);
+            breakpoints.hit = 0;
             debug = 0;
         }
     }
 
     cpu.cycles -= 1;
-
+    cpu.totalCycles += 1;
 
     return ret;
 }
 
+static u8
+cpu_clock() {
+    return cpu_clock_variant(0);
+}
+
+static u8
+cpu_clock_hooked() {
+    return cpu_clock_variant(1);
+}
+
 #endif /*CPU2AO3_H*/
@@ -22,23 +22,40 @@ typedef struct cpu2ao3 {
     u8  Yreq;
     u8  accumReq;
 
-    //  Processor status
+    //  Processor status, Zero and Negative bits are not kept up to date here,
+    //  use cpu_status() to read the full reqister
     u8  flags;
+    //  Zero flag is set when this is 0, Negative flag is bit 7 of this
+    u8  zeroResult;
+    u8  negativeResult;
     //  Program counter
     u16 pc;
 
     u8  stackPointer;
     u32 cycles;
 
+    //  IrqSource bits of devices holding the IRQ line
+    u8  irqLines;
+
     u64 instructionCount;
+    //  cpu cycles since reset
+    u64 totalCycles;
 } cpu2ao3;
 
 // global cpu variable
 cpu2ao3 cpu = {
-    .Xreq = 0, .Yreq = 0, .accumReq = 0, .flags = 0, .pc = 0x0, // pc is read from program start ptr
+    .Xreq = 0, .Yreq = 0, .accumReq = 0, .flags = 0, .zeroResult = 1, .pc = 0x0, // pc is read from program start ptr
     .stackPointer = STACK_SIZE, .cycles = 0
 };
 
+// IRQ is level triggered, cpu takes it between instructions while any
+// source holds the line and interrupts are enabled
+typedef enum IrqSource {
+    IrqMapper       = (1 << 0),
+    IrqApuFrame     = (1 << 1),
+    IrqApuDmc       = (1 << 2),
+} IrqSource;
+
 typedef enum CpuStatus {
     Carry           = (1 << 0),
     Zero            = (1 << 1),
@@ -70,6 +87,12 @@ typedef enum AddressMode {
     INDY,
 } AddressMode ;
 
+// number of operand bytes following the opcode for each address mode
+static const u8 addressModeOperandBytes[] = {
+    [IMP] = 0, [ACCUM] = 0, [IMM] = 1, [ZP] = 1, [ZPX] = 1, [ZPY] = 1, [REL] = 1,
+    [ABS] = 2, [ABSX] = 2, [ABSY] = 2, [IND] = 2, [INDX] = 1, [INDY] = 1
+};
+
 // https://www.masswerk.at/6502/6502_instruction_set.html
 typedef enum Instructions {
 
@@ -175,7 +198,7 @@ typedef struct Instruction {
 
 #define CREATE_INSTRUCTION_TABLE(IN, ADDR, CYCLE) { .instructionCode = IN, .addressMode = ADDR, .cycles = CYCLE },
 
-Instruction instructionTable[] = {
+const Instruction instructionTable[] = {
     INSTRUCTION_TABLE(CREATE_INSTRUCTION_TABLE)
 };
 
@@ -187,4 +210,15 @@ char* cpuInstructionStrings[] = {
     INSTRUCTION_TABLE(CREATE_CPU_TABLE_STING)
 };
 
+// every opcode as a literal, used to generate code per opcode (jit.h)
+#define OPCODE_ROW(FN, H) \
+    FN(0x##H##0) FN(0x##H##1) FN(0x##H##2) FN(0x##H##3) FN(0x##H##4) FN(0x##H##5) FN(0x##H##6) FN(0x##H##7) \
+    FN(0x##H##8) FN(0x##H##9) FN(0x##H##A) FN(0x##H##B) FN(0x##H##C) FN(0x##H##D) FN(0x##H##E) FN(0x##H##F)
+
+#define OPCODE_LIST(FN) \
+    OPCODE_ROW(FN, 0) OPCODE_ROW(FN, 1) OPCODE_ROW(FN, 2) OPCODE_ROW(FN, 3) \
+    OPCODE_ROW(FN, 4) OPCODE_ROW(FN, 5) OPCODE_ROW(FN, 6) OPCODE_ROW(FN, 7) \
+    OPCODE_ROW(FN, 8) OPCODE_ROW(FN, 9) OPCODE_ROW(FN, A) OPCODE_ROW(FN, B) \
+    OPCODE_ROW(FN, C) OPCODE_ROW(FN, D) OPCODE_ROW(FN, E) OPCODE_ROW(FN, F)
+
 #endif /* CPUDATA_H */
@@ -166,8 +166,9 @@ memory_debugger() {
 
     nk_layout_row_push(ctx, 50);
     char* flags[] = { "C", "Z","I", "D", "B" ,"U", "V", "N" };
+    u8 status = cpu_status();
     for(int i = 0; i < 8; i++){
-        if(cpu.flags & (1 << i)) {
+        if(status & (1 << i)) {
             nk_label_colored(ctx, flags[i], NK_TEXT_CENTERED, nk_rgb(200, 200, 0));
         } else {
             nk_label(ctx, flags[i], NK_TEXT_CENTERED);
@@ -214,9 +215,11 @@ static inline void
 instruction_label(InstructionLabel label, u16 wantedAddr) {
 
     char reqString[64];
-    sprintf ( reqString,"0x%04X", label.pos);
+    if(!cartridge_label(label.pos, reqString)) {
+        sprintf ( reqString,"0x%04X", label.pos);
+    }
 
-    if(label.pos == breakpoint) {
+    if(breakpoint_bit(breakpoints.execute, label.pos)) {
         int temp = wantedAddr == label.pos;
         if(nk_selectable_label(ctx, reqString, NK_TEXT_LEFT, &temp)) {
             sprintf ( peekString,"%X", label.pos);
@@ -290,6 +293,17 @@ intruction_debugger() {
         }
     }
 
+    {
+        int tracing = trace.enabled;
+        if(nk_checkbox_label(ctx, "Trace", &tracing)) {
+            if(tracing) trace_enable(TRACE_DEFAULT_RECORDS);
+            else trace.enabled = 0;
+        }
+        if(trace.records && nk_button_label(ctx, "Dump trace")) {
+            trace_dump(TRACE_DUMP_FILE);
+        }
+    }
+
     //if(nk_checkbox_label(ctx, "Debug", &debug)) {
     //    frameSkip = 0;
     //}
@@ -311,35 +325,58 @@ intruction_debugger() {
         wantedAddr = (u16)strtol(peekString, NULL, 16);
     }
     {
-        nk_layout_row(ctx, NK_STATIC, 25, 2, ratio);
+        // address, kinds and optional condition like "A==10" or "V&80"
         static char breakString[64];
         static int breakLen = 0;
+        static char conditionString[64];
+        static int conditionLen = 0;
+        static int breakExecute = 1, breakRead = 0, breakWrite = 0;
+
+        nk_layout_row(ctx, NK_STATIC, 25, 2, ratio);
         nk_label(ctx, "Breakpoint:", NK_TEXT_LEFT);
         nk_edit_string(ctx, NK_EDIT_SIMPLE, breakString, &breakLen, 5, nk_filter_hex);
         breakString[breakLen] = 0;
 
-        if(breakLen != 0) {
-            breakpoint = (u16)strtol(breakString, NULL, 16);
-        } else {
-            breakpoint = 0x10000;
-        }
-    }
-#if 0
-    {
         nk_layout_row(ctx, NK_STATIC, 25, 2, ratio);
-        static char breakString[64] = "0";
-        static int breakLen = 1;
-        nk_label(ctx, "CountBreakPoint:", NK_TEXT_LEFT);
-        nk_edit_string(ctx, NK_EDIT_SIMPLE, breakString, &breakLen, 10, nk_filter_default);
-        breakString[breakLen] = 0;
+        nk_label(ctx, "Condition:", NK_TEXT_LEFT);
+        nk_edit_string(ctx, NK_EDIT_SIMPLE, conditionString, &conditionLen, 16, nk_filter_default);
+        conditionString[conditionLen] = 0;
+
+        nk_layout_row_dynamic(ctx, 25, 4);
+        nk_checkbox_label(ctx, "Exec", &breakExecute);
+        nk_checkbox_label(ctx, "Read", &breakRead);
+        nk_checkbox_label(ctx, "Write", &breakWrite);
+        if(nk_button_label(ctx, "Add") && breakLen != 0) {
+            Breakpoint bp = { .addr = (u16)strtol(breakString, NULL, 16) };
+            bp.kind = (breakExecute ? BreakExecute : 0) | (breakRead ? BreakRead : 0) |
+                (breakWrite ? BreakWrite : 0);
+            if(!breakpoint_parse_condition(conditionString, &bp)) {
+                LOG("invalid breakpoint condition %s", conditionString);
+            } else if(bp.kind) {
+                breakpoint_add(bp);
+            }
+        }
 
-        if(breakLen != 0) {
-            instructionCountBreakPoint = (u16)strtol(breakString, NULL, 10);
-        } else {
-            instructionCountBreakPoint = 0;
+        static const char* operandNames[] = { "", "A", "X", "Y", "SP", "P", "V" };
+        static const char* compareNames[] = { "==", "!=", "<", ">", "&" };
+        for(u32 i = 0; i < breakpoints.count; i++) {
+            Breakpoint* bp = &breakpoints.list[i];
+            char bpString[64];
+            i32 len = sprintf(bpString, "0x%04X %s%s%s", bp->addr,
+                    bp->kind & BreakExecute ? "x" : "", bp->kind & BreakRead ? "r" : "",
+                    bp->kind & BreakWrite ? "w" : "");
+            if(bp->operand != BreakAlways) {
+                sprintf(bpString + len, " %s%s%02X", operandNames[bp->operand],
+                        compareNames[bp->compare], bp->value);
+            }
+            nk_layout_row(ctx, NK_STATIC, 25, 2, ratio);
+            nk_label(ctx, bpString, NK_TEXT_LEFT);
+            if(nk_button_label(ctx, "Remove")) {
+                breakpoint_remove(i);
+                break;
+            }
         }
     }
-#endif
     //char* notKnownOperand = "Outside of PRG mem";
     char* errOp = "ERR OP";
 
@@ -350,6 +387,7 @@ intruction_debugger() {
 
     for(i32 i = 13; i >= 0; tempPC--) {
 
+        if(!cartridge_instruction_start(tempPC)) continue;
         char* val = cartridge_read_disassembly(tempPC);
 
         if (val && *val != '\0') {
@@ -376,6 +414,7 @@ intruction_debugger() {
     tempPC = wantedAddr + 1;
     for(u16 i = 15; i < 29; tempPC++) {
 
+        if(!cartridge_instruction_start(tempPC)) continue;
         char* val = cartridge_read_disassembly(tempPC);
         if (val && *val != '\0') {
             instructionCache[i] = (struct InstructionLabel) {
@@ -33,6 +33,8 @@ static const u64 numeric_max_u64 = 0xFFFFFFFFFFFFFFFF;
 
 #define typeof __typeof__
 
+#define FORCE_INLINE inline __attribute__((always_inline))
+
 #define BIT_CHECK(a,b) ((a & b) > 0)
 #define BIT_SET(a,b) ( a |= b)
 #define BIT_UNSET(a,b) (a &= ~b)
@@ -85,14 +87,7 @@ glCheckError_(const char *file, int line) {
 #define gl_check_error() glCheckError_(__FILE__, __LINE__)
 #define GLCHECK(FUN) do{FUN; glCheckError_(__FILE__, __LINE__); } while(0)
 
-//#define LOGFILE
-
-#ifdef LOGFILE
-static FILE* logfile;
-static int numWritten;
-#define CHECKLOG {if(numWritten++ > 1000000){fclose(logfile); exit(1);} if(!logfile){  printf("log file opened!\n"); logfile = fopen("logfile.txt", "w");}}
-#else
-#define CHECKLOG
-#endif
+// enables cpu sanity checks (stack overflow/underflow) that are too costly for normal runs
+//#define CPU_DEBUG
 
 #endif
@@ -0,0 +1,257 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+
+#include "defs.h"
+#include "printutils.h"
+#include "fileload.h"
+#include "cpudata.h"
+#include "mapperdata.h"
+
+// Static disassembler for PRG rom
+//
+// Code is found by following control flow from NMI, reset and IRQ vectors.
+// JMP, JSR and branch targets are followed, RTS, RTI, BRK, indirect JMP and
+// unknown opcodes end the path. Cpu address of code is only known within
+// 16K banks: targets in the same 16K cpu region stay in the bank and others
+// are resolved as mapped at power on, first bank at $8000 and last at $C000
+// (NROM, MMC1 and UxROM boot like this).
+//
+// Result only depends on the rom, it is cached by rom CRC32 so next load of
+// the same rom does not need to follow the code again.
+
+#define DISASSEMBLER_BANK_SIZE      PROG_ROM_SINGLE_SIZE
+#define DISASSEMBLER_CACHE_MAGIC    "NESDISAS"
+#define DISASSEMBLER_CACHE_VERSION  1
+
+typedef struct DisassemblerCacheHeader {
+    char    magic[8];
+    u32     version;
+    u32     programMemoryLen;
+} DisassemblerCacheHeader;
+
+static inline u8
+bitmap_get(const u8* bitmap, u32 index) {
+    return bitmap[index >> 3] & (1 << (index & 7));
+}
+
+static inline void
+bitmap_set(u8* bitmap, u32 index) {
+    bitmap[index >> 3] |= 1 << (index & 7);
+}
+
+// PRG offset of target jumped to from cpu address at PRG offset, numeric_max_u32 if unknown
+static u32
+disassembler_resolve(MapperHeader* data, u32 fromOffset, u16 fromAddr, u16 target) {
+
+    // code in ram
+    if(target < PRG_WINDOW_START) return numeric_max_u32;
+
+    u32 bankOffset = target & (DISASSEMBLER_BANK_SIZE - 1);
+    if((target & ~(DISASSEMBLER_BANK_SIZE - 1)) == (fromAddr & ~(DISASSEMBLER_BANK_SIZE - 1))) {
+        return (fromOffset & ~(DISASSEMBLER_BANK_SIZE - 1)) + bankOffset;
+    }
+    if(target >= PRG_WINDOW_START + DISASSEMBLER_BANK_SIZE) {
+        return data->programMemoryLen - DISASSEMBLER_BANK_SIZE + bankOffset;
+    }
+    return bankOffset;
+}
+
+typedef struct DisassemblerEntry {
+    u32 offset;
+    u16 addr;
+} DisassemblerEntry;
+
+typedef struct DisassemblerStack {
+    DisassemblerEntry*  entries;
+    u32                 count;
+    u32                 capacity;
+} DisassemblerStack;
+
+static void
+disassembler_push(DisassemblerStack* stack, u32 offset, u16 addr) {
+
+    if(stack->count == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 256;
+        stack->entries = realloc(stack->entries, stack->capacity * sizeof(DisassemblerEntry));
+        ASSERT_MESSAGE(stack->entries, "failed to allocate disassembler stack");
+    }
+    stack->entries[stack->count++] = (DisassemblerEntry){ .offset = offset, .addr = addr };
+}
+
+// marks target as label and queues it, returns 0 if target is unknown
+static u8
+disassembler_add_target(MapperHeader* data, DisassemblerStack* stack,
+        u32 fromOffset, u16 fromAddr, u16 target, u8 subroutine) {
+
+    u32 offset = disassembler_resolve(data, fromOffset, fromAddr, target);
+    if(offset == numeric_max_u32) return 0;
+
+    bitmap_set(subroutine ? data->analysis.subroutines : data->analysis.labels, offset);
+    if(!bitmap_get(data->analysis.starts, offset)) disassembler_push(stack, offset, target);
+    return 1;
+}
+
+static void
+disassembler_follow_code(MapperHeader* data) {
+
+    CodeAnalysis* analysis = &data->analysis;
+    DisassemblerStack stack = { 0 };
+    const u8* prg = data->programMemory;
+
+    // NMI, reset and IRQ vectors are at the end of last bank
+    static const u16 vectors[] = { 0xFFFA, 0xFFFC, 0xFFFE };
+    u32 lastBank = data->programMemoryLen - DISASSEMBLER_BANK_SIZE;
+    for(u32 i = 0; i < SIZEOF_ARRAY(vectors); i++) {
+        u16 vector = vectors[i];
+        u32 offset = lastBank + (vector & (DISASSEMBLER_BANK_SIZE - 1));
+        u16 target = prg[offset] | (prg[offset + 1] << 8);
+        disassembler_add_target(data, &stack, offset, vector, target, 1);
+    }
+
+    while(stack.count) {
+
+        DisassemblerEntry entry = stack.entries[--stack.count];
+        u32 offset = entry.offset;
+        u16 addr = entry.addr;
+
+        while(!bitmap_get(analysis->starts, offset)) {
+
+            Instruction instruction = instructionTable[prg[offset]];
+            if(instruction.instructionCode == XXX) break;
+
+            u32 length = 1 + addressModeOperandBytes[instruction.addressMode];
+            if(offset + length > data->programMemoryLen) break;
+
+            bitmap_set(analysis->starts, offset);
+            for(u32 i = 0; i < length; i++) bitmap_set(analysis->covered, offset + i);
+
+            u16 operand = length == 1 ? 0 : length == 2 ? prg[offset + 1] :
+                prg[offset + 1] | (prg[offset + 2] << 8);
+
+            u8 endsPath = 0;
+            switch(instruction.instructionCode) {
+                case JMP:
+                    {
+                        if(instruction.addressMode == ABS) {
+                            disassembler_add_target(data, &stack, offset, addr, operand, 0);
+                        }
+                        endsPath = 1;
+                    } break;
+                case JSR:
+                    {
+                        disassembler_add_target(data, &stack, offset, addr, operand, 1);
+                    } break;
+                case BCC: case BCS: case BEQ: case BMI: case BNE: case BPL: case BVC: case BVS:
+                    {
+                        u16 target = addr + length + (i8)operand;
+                        disassembler_add_target(data, &stack, offset, addr, target, 0);
+                    } break;
+                case RTS: case RTI: case BRK:
+                    endsPath = 1;
+                    break;
+            }
+            if(endsPath) break;
+
+            // next instruction might be in other bank if it crosses 16K cpu region
+            u16 next = addr + length;
+            if(next < addr) break;
+            offset = disassembler_resolve(data, offset, addr, next);
+            addr = next;
+            if(offset == numeric_max_u32 || offset >= data->programMemoryLen) break;
+        }
+    }
+
+    free(stack.entries);
+}
+
+static u8
+disassembler_cache_path(char* buffer, size_t bufferLen) {
+
+    char name[32];
+    sprintf(name, "%08X.dis", cartridge.crc32);
+    return cache_file_path(buffer, bufferLen, name);
+}
+
+static u8
+disassembler_cache_load(MapperHeader* data, u32 bitmapLen) {
+
+    char path[1024];
+    if(!disassembler_cache_path(path, sizeof(path))) return 0;
+
+    FILE* file = fopen(path, "rb");
+    if(!file) return 0;
+
+    DisassemblerCacheHeader header;
+    u8 ret = fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.magic, DISASSEMBLER_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == DISASSEMBLER_CACHE_VERSION &&
+        header.programMemoryLen == data->programMemoryLen &&
+        fread(data->analysis.starts, bitmapLen, 4, file) == 4;
+
+    fclose(file);
+    // following code skips offsets already in starts, so a partly read
+    // cache would hide code
+    if(!ret) memset(data->analysis.starts, 0, bitmapLen * 4);
+    return ret;
+}
+
+static void
+disassembler_cache_save(MapperHeader* data, u32 bitmapLen) {
+
+    char path[1024];
+    char tempPath[1024 + 4];
+    if(!disassembler_cache_path(path, sizeof(path))) return;
+
+    // written next to the cache and renamed over it, so interrupted save
+    // does not leave a truncated cache
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    FILE* file = fopen(tempPath, "wb");
+    if(!file) {
+        LOG("failed to write disassembly cache %s", tempPath);
+        return;
+    }
+
+    DisassemblerCacheHeader header = {
+        .magic = DISASSEMBLER_CACHE_MAGIC, .version = DISASSEMBLER_CACHE_VERSION,
+        .programMemoryLen = data->programMemoryLen
+    };
+    u8 written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(data->analysis.starts, bitmapLen, 4, file) == 4;
+    written = fclose(file) == 0 && written;
+
+    if(!written || rename(tempPath, path) != 0) {
+        LOG("failed to write disassembly cache %s", path);
+        remove(tempPath);
+    }
+}
+
+// fills data->analysis from cache or by following the code
+static void
+disassembler_analyze(MapperHeader* data) {
+
+    // all bitmaps are in one block, in order of CodeAnalysis
+    u32 bitmapLen = data->programMemoryLen / 8;
+    u8* block = calloc(4, bitmapLen);
+    ASSERT_MESSAGE(block, "failed to allocate code analysis");
+    data->analysis = (CodeAnalysis) {
+        .starts = block, .covered = block + bitmapLen,
+        .labels = block + bitmapLen * 2, .subroutines = block + bitmapLen * 3
+    };
+
+    if(disassembler_cache_load(data, bitmapLen)) return;
+
+    disassembler_follow_code(data);
+    disassembler_cache_save(data, bitmapLen);
+}
+
+static void
+disassembler_dispose(MapperHeader* data) {
+    free(data->analysis.starts);
+    memset(&data->analysis, 0, sizeof(data->analysis));
+}
+
+#endif /* DISASSEMBLER_H */
@@ -0,0 +1,222 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef DISCRETE_H
+#define DISCRETE_H
+
+// Discrete logic mappers
+//
+// Boards that are just a latch written at $8000-$FFFF and some logic picking
+// banks from it. Mapper declares the size of its PRG and CHR windows and how
+// the written value decodes to bank numbers, everything else is shared here.
+// Bank numbers are resolved to 8 KB PRG and 1 KB CHR table entries on write,
+// so reads are one table lookup with no per mapper code.
+
+#define DISCRETE_PRG_TABLE_SIZE     0x2000 // 8 K
+#define DISCRETE_CHR_TABLE_SIZE     0x400  // 1 K
+
+// decode leaves mirroring from the header
+#define DISCRETE_MIRROR_HEADER      0xFF
+
+// bank number that selects the last bank, outside of values decoded from the
+// latch so it works for any bank count
+#define DISCRETE_LAST_BANK          0x100
+
+// Bank numbers for each PRG and CHR window, taken modulo the bank count
+typedef struct DiscreteBanks {
+    u16 prg[2];
+    u16 chr[2];
+    u8  mirrorType;
+} DiscreteBanks;
+
+typedef void (*discrete_decode_func)(u8 /*val*/, DiscreteBanks* /*banks*/);
+
+struct DiscreteLayout {
+    u32                     prgWindowSize;  // 16 K or 32 K
+    u32                     chrWindowSize;  // 4 K or 8 K
+    // value written is ANDed with the rom byte at the address
+    u8                      busConflicts;
+    discrete_decode_func    decode;
+};
+
+static inline u32
+discrete_resolve_bank(u16 bank, u32 numBanks) {
+    return bank == DISCRETE_LAST_BANK ? numBanks - 1 : bank % numBanks;
+}
+
+static void
+discrete_update_banks(DiscreteData* data, u8 val) {
+
+    const DiscreteLayout* layout = data->layout;
+    DiscreteBanks banks = { .mirrorType = DISCRETE_MIRROR_HEADER };
+    layout->decode(val, &banks);
+
+    u32 prgLen = data->head.programMemoryLen;
+    u32 numPrgBanks = prgLen > layout->prgWindowSize ? prgLen / layout->prgWindowSize : 1;
+    u32 prgEntries = layout->prgWindowSize / DISCRETE_PRG_TABLE_SIZE;
+    for(u32 i = 0; i < 4; i++) {
+        u32 bank = discrete_resolve_bank(banks.prg[i / prgEntries], numPrgBanks);
+        // 16 K rom is mirrored in 32 K window
+        data->prgBanks[i] = (bank * layout->prgWindowSize + (i % prgEntries) * DISCRETE_PRG_TABLE_SIZE) % prgLen;
+    }
+
+    u32 chrLen = data->head.characterMemoryLen;
+    u32 numChrBanks = chrLen > layout->chrWindowSize ? chrLen / layout->chrWindowSize : 1;
+    u32 chrEntries = layout->chrWindowSize / DISCRETE_CHR_TABLE_SIZE;
+    for(u32 i = 0; i < 8; i++) {
+        u32 bank = discrete_resolve_bank(banks.chr[i / chrEntries], numChrBanks);
+        data->chrBanks[i] = (bank * layout->chrWindowSize + (i % chrEntries) * DISCRETE_CHR_TABLE_SIZE) % chrLen;
+    }
+
+    if(banks.mirrorType != DISCRETE_MIRROR_HEADER) cartridge.mirrorType = banks.mirrorType;
+
+    data->reqister = val;
+    mapperheader_invalidate_windows(&data->head);
+}
+
+static void
+discrete_init(DiscreteData* data, const DiscreteLayout* layout, const u8* progMem, const u8* charMem) {
+
+    mapperheader_init(&data->head, progMem, charMem);
+    data->layout = layout;
+    discrete_update_banks(data, 0);
+}
+
+void
+discrete_dispose(DiscreteData* data) {
+
+    mapperheader_dispose(&data->head);
+    memset(data, 0 ,sizeof *data);
+}
+
+u32
+discrete_prg_offset(DiscreteData* data, u16 addr) {
+
+    if(addr < PRG_WINDOW_START) return numeric_max_u32;
+    return data->prgBanks[(addr >> 13) & 0x3] + (addr & (DISCRETE_PRG_TABLE_SIZE - 1));
+}
+
+char*
+discrete_disassemble(DiscreteData* data, u16 addr) {
+
+    u32 address = discrete_prg_offset(data, addr);
+    if(address == numeric_max_u32) return notKnownOperand;
+    return mapperheader_disassembly(&data->head, address);
+}
+
+static inline u8
+discrete_cpu_read(DiscreteData* data, u16 addr) {
+
+    if(addr < PRG_WINDOW_START) return 0;
+
+    u32 address = data->prgBanks[(addr >> 13) & 0x3] + (addr & (DISCRETE_PRG_TABLE_SIZE - 1));
+    data->head.prgCdl[address] |= CdlData | CDL_WINDOW(addr);
+    return data->head.programMemory[address];
+}
+
+u8
+discrete_cpu_peak(DiscreteData* data, u16 addr, u8* valid) {
+
+    if(addr < PRG_WINDOW_START) return 0;
+
+    if(valid) *valid = 1;
+    return data->head.programMemory[discrete_prg_offset(data, addr)];
+}
+
+void
+discrete_cpu_write(DiscreteData* data, u16 addr, u8 val) {
+
+    if(addr < PRG_WINDOW_START) return;
+
+    if(data->layout->busConflicts) {
+        val &= data->head.programMemory[discrete_prg_offset(data, addr)];
+    }
+    discrete_update_banks(data, val);
+}
+
+static inline u8
+discrete_ppu_read(DiscreteData* data, u16 addr) {
+
+    u32 address = data->chrBanks[(addr >> 10) & 0x7] + (addr & (DISCRETE_CHR_TABLE_SIZE - 1));
+    data->head.chrCdl[address] |= data->head.chrCdlAccess;
+    return data->head.characterMemory[address];
+}
+
+void
+discrete_ppu_write(DiscreteData* data, u16 addr, u8 val) {
+
+    u32 address = data->chrBanks[(addr >> 10) & 0x7] + (addr & (DISCRETE_CHR_TABLE_SIZE - 1));
+    if(data->head.characterRam) data->head.characterRam[address] = val;
+}
+
+// UxROM: 16 K switchable at $8000, last bank fixed at $C000
+static void
+uxrom_decode(u8 val, DiscreteBanks* banks) {
+    banks->prg[0] = val;
+    banks->prg[1] = DISCRETE_LAST_BANK;
+}
+
+// CNROM: PRG fixed, 8 K CHR switchable
+static void
+cnrom_decode(u8 val, DiscreteBanks* banks) {
+    banks->chr[0] = val & 0x3;
+}
+
+// AxROM: 32 K switchable, bit 4 selects one screen nametable
+static void
+axrom_decode(u8 val, DiscreteBanks* banks) {
+    banks->prg[0] = val & 0x7;
+    banks->mirrorType = val & 0x10 ? ONESCREEN_HI : ONESCREEN_LO;
+}
+
+// Color Dreams: 32 K PRG in low bits, 8 K CHR in high bits
+static void
+colordreams_decode(u8 val, DiscreteBanks* banks) {
+    banks->prg[0] = val & 0x3;
+    banks->chr[0] = val >> 4;
+}
+
+// GxROM: 32 K PRG in bits 4-5, 8 K CHR in low bits
+static void
+gxrom_decode(u8 val, DiscreteBanks* banks) {
+    banks->prg[0] = (val >> 4) & 0x3;
+    banks->chr[0] = val & 0x3;
+}
+
+//  MAPPER(name, PRG window, CHR window, bus conflicts, decode)
+#define DISCRETE_MAPPER_LIST(MAPPER)                            \
+    MAPPER(mapper2,  0x4000, 0x2000, 1, uxrom_decode)           \
+    MAPPER(mapper3,  0x8000, 0x2000, 1, cnrom_decode)           \
+    MAPPER(mapper7,  0x8000, 0x2000, 0, axrom_decode)           \
+    MAPPER(mapper11, 0x8000, 0x2000, 0, colordreams_decode)     \
+    MAPPER(mapper66, 0x8000, 0x2000, 1, gxrom_decode)
+
+#define DISCRETE_MAPPER(NAME, PRG_WINDOW, CHR_WINDOW, BUS_CONFLICTS, DECODE)            \
+static const DiscreteLayout NAME##Layout = {                                            \
+    .prgWindowSize = PRG_WINDOW, .chrWindowSize = CHR_WINDOW,                           \
+    .busConflicts = BUS_CONFLICTS, .decode = DECODE                                     \
+};                                                                                      \
+                                                                                        \
+void                                                                                    \
+NAME##_init(DiscreteData* data, const u8* progMem, const u8* charMem) {                 \
+    discrete_init(data, &NAME##Layout, progMem, charMem);                               \
+}                                                                                       \
+                                                                                        \
+struct Mapper NAME = {                                                                  \
+    .cpu_read_cartridge     = (cpu_read_func)discrete_cpu_read,                         \
+    .cpu_write_cartridge    = (cpu_write_func)discrete_cpu_write,                       \
+    .ppu_read_cartridge     = (ppu_read_func)discrete_ppu_read,                         \
+    .ppu_write_cartridge    = (ppu_write_func)discrete_ppu_write,                       \
+    .mapper_init            = (mapper_init_func)NAME##_init,                            \
+    .mapper_dispose         = (mapper_dispose_func)discrete_dispose,                    \
+    .cpu_prg_offset         = (prg_offset_func)discrete_prg_offset,                     \
+    .cpu_peak_cartridge     = (peak_func)discrete_cpu_peak,                             \
+    .mapper_disasseble      = (disasseble_func)discrete_disassemble                     \
+};
+
+DISCRETE_MAPPER_LIST(DISCRETE_MAPPER)
+
+#undef DISCRETE_MAPPER
+
+#endif /* DISCRETE_H */
@@ -5,6 +5,11 @@
 #ifndef FILELOAD_H
 #define FILELOAD_H
 
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 static void*
 _load_file(const char* path, char* const filetype, size_t* fileSize) {
     *fileSize = 0;
@@ -25,6 +30,58 @@ load_binary_file(const char* path, size_t* fileSize) {
     return _load_file(path,"rb", fileSize);
 }
 
+// maps file read only, pages are shared by every process mapping the same
+// file and nothing is read before it is used. Unmap with unmap_file
+static u8*
+map_binary_file(const char* path, size_t* fileSize) {
+
+    *fileSize = 0;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) return NULL;
+
+    *fileSize = st.st_size;
+    return data;
+}
+
+// maps size bytes of file for reading and writing. Shared mapping writes back
+// to the file, which is created and grown with zeroes if needed. Private
+// mapping never touches the file and pages are copied only when written, file
+// has to be at least size bytes then. Unmap with unmap_file
+static u8*
+map_writable_file(const char* path, size_t size, u8 shared) {
+
+    int fd = open(path, shared ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if(fd < 0) return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 ||
+            ((size_t)st.st_size < size && (!shared || ftruncate(fd, size) != 0))) {
+        close(fd);
+        return NULL;
+    }
+
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) return NULL;
+
+    return data;
+}
+
+static inline void
+unmap_file(void* data, size_t fileSize) {
+    if(data) munmap(data, fileSize);
+}
+
 static inline char*
 load_file(char* const path, size_t* fileSize) {
     size_t size;
@@ -43,4 +100,47 @@ filename_get_ext(char *filename) {
     return dot + 1;
 }
 
+// CRC-32 (IEEE 802.3, same as zip and rom databases), start with crc 0
+static u32
+crc32_update(u32 crc, const u8* data, size_t len) {
+
+    static u32 table[256];
+    if(table[1] == 0) {
+        for(u32 i = 0; i < 256; i++) {
+            u32 c = i;
+            for(u32 bit = 0; bit < 8; bit++) c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+
+    crc = ~crc;
+    for(size_t i = 0; i < len; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// path of file in $XDG_CACHE_HOME/nes-emu (or ~/.cache/nes-emu), directories
+// are created. Returns 0 if there is no place for cache
+static u8
+cache_file_path(char* buffer, size_t bufferLen, const char* name) {
+
+    const char* cacheHome = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    int len;
+
+    if(cacheHome && *cacheHome) {
+        len = snprintf(buffer, bufferLen, "%s", cacheHome);
+    } else if(home && *home) {
+        len = snprintf(buffer, bufferLen, "%s/.cache", home);
+        mkdir(buffer, 0755);
+    } else {
+        return 0;
+    }
+
+    len += snprintf(buffer + len, bufferLen - len, "/nes-emu");
+    mkdir(buffer, 0755);
+
+    len += snprintf(buffer + len, bufferLen - len, "/%s", name);
+    return (size_t)len < bufferLen;
+}
+
 #endif /* FILELOAD_H */
@@ -0,0 +1,570 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "defs.h"
+#include "cpu.h"
+
+// Dynamic recompiler for code running from PRG rom (x86-64 only)
+//
+// Straight line runs of instructions (blocks) are compiled to machine code that
+// calls a handler per opcode with the operand and next pc as constants. Handlers
+// are cpu_execute specialized for one opcode so the address mode and instruction
+// switches are folded away, simple instructions are emitted inline.
+//
+// Blocks never touch I/O, they only contain instructions whose memory accesses
+// are known to hit cpu ram or PRG rom. Anything else ends the block and is left
+// to the interpreter so ppu reqisters, controllers and mappers see accesses at
+// the exact cycle. Block is only run if it is finished before the ppu can raise
+// NMI or a scheduled mapper or APU event can raise IRQ, so interrupts land on
+// same instruction as with the interpreter. CLI, PLP and RTI are left to the
+// interpreter too, so blocks can run while a masked IRQ is pending.
+//
+// Blocks are keyed with the PRG memory offset (mapped bank) of the first
+// instruction and the pc they were compiled at. PRG rom is immutable, so they
+// stay valid over bank switches for the whole run.
+
+#if defined(__x86_64__) && defined(LINUX_PLATFORM)
+#define JIT_AVAILABLE
+#include <stddef.h>
+#include <sys/mman.h>
+#endif
+
+#define JIT_CODE_SIZE           (8 * 1024 * 1024)
+#define JIT_MAX_BLOCK_SIZE      2048 // machine code bytes
+#define JIT_MAX_INSTRUCTIONS    64
+// cycles one instruction can take over its base cycles (branch taken + page cross)
+#define JIT_MAX_EXTRA_CYCLES    2
+// PPU dots per frame, pre render line + 261 lines
+#define JIT_FRAME_DOTS          (262 * 341)
+
+typedef void (*jit_block_func)();
+
+typedef struct JitBlock {
+    jit_block_func  code;           // NULL when no block can start here
+    u16             pc;             // pc the block was compiled at
+    u16             cycles;         // sum of base cycles
+    u16             maxCycles;      // worst case with extra cycles
+    u16             numInstructions;
+} JitBlock;
+
+struct Jit {
+    u8*         code;
+    u32         codeUsed;
+
+    JitBlock*   blocks;
+    u32         numBlocks;
+    u32         blocksCapacity;
+
+    // blocks index + 1 for every PRG byte, 0 when not compiled
+    u32*        blockIndex;
+    u32         blockIndexLen;
+
+    u64         blocksRun;
+    u64         instructionsRun;
+} jit;
+
+// instructions that only read their memory operand
+static inline u8
+jit_is_read_only(u8 instructionCode) {
+    switch(instructionCode) {
+        case ADC: case AND: case BIT: case CMP: case CPX: case CPY:
+        case EOR: case LDA: case LDX: case LDY: case ORA: case SBC: case NOP:
+            return 1;
+    }
+    return 0;
+}
+
+// instruction can be part of a block if it can not touch I/O
+static u8
+jit_instruction_eligible(DecodedInstruction* instruct) {
+
+    if(instruct->instructionCode == XXX) return 0;
+    // might enable interrupts while IRQ is pending
+    switch(instruct->instructionCode) {
+        case CLI: case PLP: case RTI:
+            return 0;
+    }
+
+    u16 operand = instruct->operand;
+    u8 readOnly = jit_is_read_only(instruct->instructionCode);
+
+    switch(instruct->addressMode) {
+        case IMP: case ACCUM: case IMM: case ZP: case ZPX: case ZPY: case REL:
+            return 1;
+        case ABS:
+            {
+                if(instruct->instructionCode == JMP || instruct->instructionCode == JSR) return 1;
+                if(operand <= CPU_MEMORY_SIZE) return 1;
+                return readOnly && operand >= PRG_WINDOW_START;
+            }
+        case ABSX:
+        case ABSY:
+            {
+                // indexed address can be anything up to operand + 0xFF
+                if(operand + 0xFF <= CPU_MEMORY_SIZE) return 1;
+                return readOnly && operand >= PRG_WINDOW_START && operand + 0xFF <= 0xFFFF;
+            }
+    }
+    // IND, INDX and INDY can point anywhere
+    return 0;
+}
+
+static inline u8
+jit_ends_block(u8 instructionCode) {
+    switch(instructionCode) {
+        case BCC: case BCS: case BEQ: case BMI: case BNE: case BPL: case BVC: case BVS:
+        case JMP: case JSR: case RTS: case RTI: case BRK:
+            return 1;
+    }
+    return 0;
+}
+
+// cpu cycles that can be run before ppu might raise NMI or event IRQ
+static u32
+jit_cycle_budget() {
+
+    // pending IRQ is taken by the interpreter between instructions
+    if(ppu.NMIGenerated || (cpu.irqLines && !(cpu.flags & DisableIterups))) return 0;
+
+    u32 budget = numeric_max_u16;
+    if(ppu.controllerReq & GenerateNMI) {
+        i32 dot = (ppu.scanline + 1) * 341 + ppu.cycle;
+        i32 nmiDot = (241 + 1) * 341 + 1;
+        i32 dots = nmiDot - dot;
+        if(dots < 0) dots += JIT_FRAME_DOTS;
+
+        // margin for odd frame skip and cpu running every third dot
+        budget = dots > 6 ? (u32)(dots - 6) / 3 : 0;
+    }
+
+    // mapper or APU event might raise IRQ
+    if(ppu.eventDot) {
+        u64 now = ppu_dot();
+        u64 dots = ppu.eventDot > now ? ppu.eventDot - now : 0;
+        if(dots < 6) return 0;
+        if((dots - 6) / 3 < budget) budget = (dots - 6) / 3;
+    }
+
+    return budget;
+}
+
+static void jit_flush();
+
+#ifdef JIT_AVAILABLE
+
+// Handler per opcode, called from compiled code
+#define JIT_OP_HANDLER(OPCODE)                                                  \
+static void                                                                     \
+jit_op_##OPCODE(u32 operand, u32 nextPc) {                                      \
+    DecodedInstruction instruct = {                                             \
+        .operand = operand, .opcode = OPCODE,                                   \
+        .instructionCode = instructionTable[OPCODE].instructionCode,            \
+        .addressMode = instructionTable[OPCODE].addressMode,                    \
+        .cycles = instructionTable[OPCODE].cycles,                              \
+        .length = 1 + addressModeOperandBytes[instructionTable[OPCODE].addressMode] \
+    };                                                                          \
+    cpu.pc = nextPc;                                                            \
+    cpu_execute(instruct, 0);                                                      \
+}
+
+OPCODE_LIST(JIT_OP_HANDLER)
+
+typedef void (*jit_op_func)(u32 operand, u32 nextPc);
+
+#define JIT_OP_HANDLER_ENTRY(OPCODE) [OPCODE] = jit_op_##OPCODE,
+
+static const jit_op_func jitOpHandlers[256] = {
+    OPCODE_LIST(JIT_OP_HANDLER_ENTRY)
+};
+
+// x86-64 encoding, rbx holds &cpu and r12 holds ram during a block
+#define CPU_OFFSET(MEMBER) ((u8)offsetof(cpu2ao3, MEMBER))
+
+STATIC_ASSERT(sizeof(cpu2ao3) < 128, cpu_fits_8bit_displacement);
+
+static inline void
+jit_emit8(u8 val) {
+    jit.code[jit.codeUsed++] = val;
+}
+
+static inline void
+jit_emit16(u16 val) {
+    memcpy(&jit.code[jit.codeUsed], &val, sizeof(val));
+    jit.codeUsed += sizeof(val);
+}
+
+static inline void
+jit_emit32(u32 val) {
+    memcpy(&jit.code[jit.codeUsed], &val, sizeof(val));
+    jit.codeUsed += sizeof(val);
+}
+
+static inline void
+jit_emit64(u64 val) {
+    memcpy(&jit.code[jit.codeUsed], &val, sizeof(val));
+    jit.codeUsed += sizeof(val);
+}
+
+static void
+jit_emit_prologue() {
+    jit_emit8(0x53);                                    // push rbx
+    jit_emit8(0x41); jit_emit8(0x54);                   // push r12
+    jit_emit8(0x48); jit_emit8(0x83); jit_emit8(0xEC); jit_emit8(0x08); // sub rsp, 8
+    jit_emit8(0x48); jit_emit8(0xBB); jit_emit64((u64)(uintptr_t)&cpu); // mov rbx, &cpu
+    jit_emit8(0x49); jit_emit8(0xBC); jit_emit64((u64)(uintptr_t)ram);  // mov r12, ram
+}
+
+static void
+jit_emit_epilogue() {
+    jit_emit8(0x48); jit_emit8(0x83); jit_emit8(0xC4); jit_emit8(0x08); // add rsp, 8
+    jit_emit8(0x41); jit_emit8(0x5C);                   // pop r12
+    jit_emit8(0x5B);                                    // pop rbx
+    jit_emit8(0xC3);                                    // ret
+}
+
+// mov al, [rbx + member]
+static inline void
+jit_emit_load_al(u8 offset) {
+    jit_emit8(0x8A); jit_emit8(0x43); jit_emit8(offset);
+}
+
+// mov [rbx + member], al
+static inline void
+jit_emit_store_al(u8 offset) {
+    jit_emit8(0x88); jit_emit8(0x43); jit_emit8(offset);
+}
+
+// mov byte [rbx + member], imm8
+static inline void
+jit_emit_store_imm(u8 offset, u8 val) {
+    jit_emit8(0xC6); jit_emit8(0x43); jit_emit8(offset); jit_emit8(val);
+}
+
+// mov al, [r12 + zp]
+static inline void
+jit_emit_load_ram_al(u8 zp) {
+    jit_emit8(0x41); jit_emit8(0x8A); jit_emit8(0x84); jit_emit8(0x24); jit_emit32(zp);
+}
+
+// mov [r12 + zp], al
+static inline void
+jit_emit_store_ram_al(u8 zp) {
+    jit_emit8(0x41); jit_emit8(0x88); jit_emit8(0x84); jit_emit8(0x24); jit_emit32(zp);
+}
+
+// SET_ZN(al)
+static inline void
+jit_emit_set_zn_al() {
+    jit_emit_store_al(CPU_OFFSET(zeroResult));
+    jit_emit_store_al(CPU_OFFSET(negativeResult));
+}
+
+static void
+jit_emit_call(DecodedInstruction* instruct, u16 nextPc) {
+    jit_emit8(0xBF); jit_emit32(instruct->operand);     // mov edi, operand
+    jit_emit8(0xBE); jit_emit32(nextPc);                // mov esi, nextPc
+    jit_emit8(0x48); jit_emit8(0xB8);                   // mov rax, handler
+    jit_emit64((u64)(uintptr_t)jitOpHandlers[instruct->opcode]);
+    jit_emit8(0xFF); jit_emit8(0xD0);                   // call rax
+}
+
+static u8
+jit_register_offset(u8 instructionCode) {
+    switch(instructionCode) {
+        case LDA: case STA: case TXA: case TYA: return CPU_OFFSET(accumReq);
+        case LDX: case STX: case TAX: case TSX: case INX: case DEX: return CPU_OFFSET(Xreq);
+        case LDY: case STY: case TAY: case INY: case DEY: return CPU_OFFSET(Yreq);
+        case TXS: return CPU_OFFSET(stackPointer);
+    }
+    return 0;
+}
+
+// simple instructions are emitted directly, they can not add cycles
+// or change pc so pc is only stored at end of block. Returns 0 if not handled
+static u8
+jit_emit_inline(DecodedInstruction* instruct) {
+
+    u8 code = instruct->instructionCode;
+    u8 reg = jit_register_offset(code);
+
+    switch(code) {
+        case LDA: case LDX: case LDY:
+            {
+                if(instruct->addressMode == IMM) {
+                    jit_emit_store_imm(reg, (u8)instruct->operand);
+                    jit_emit_store_imm(CPU_OFFSET(zeroResult), (u8)instruct->operand);
+                    jit_emit_store_imm(CPU_OFFSET(negativeResult), (u8)instruct->operand);
+                    return 1;
+                }
+                if(instruct->addressMode == ZP) {
+                    jit_emit_load_ram_al((u8)instruct->operand);
+                    jit_emit_store_al(reg);
+                    jit_emit_set_zn_al();
+                    return 1;
+                }
+            } break;
+        case STA: case STX: case STY:
+            {
+                if(instruct->addressMode == ZP) {
+                    jit_emit_load_al(reg);
+                    jit_emit_store_ram_al((u8)instruct->operand);
+                    return 1;
+                }
+            } break;
+        case INX: case INY: case DEX: case DEY:
+            {
+                jit_emit_load_al(reg);
+                jit_emit8(0xFE); jit_emit8(code == INX || code == INY ? 0xC0 : 0xC8); // inc/dec al
+                jit_emit_store_al(reg);
+                jit_emit_set_zn_al();
+                return 1;
+            }
+        case TAX: case TAY:
+            {
+                jit_emit_load_al(CPU_OFFSET(accumReq));
+                jit_emit_store_al(reg);
+                jit_emit_set_zn_al();
+                return 1;
+            }
+        case TXA: case TYA:
+            {
+                jit_emit_load_al(code == TXA ? CPU_OFFSET(Xreq) : CPU_OFFSET(Yreq));
+                jit_emit_store_al(reg);
+                jit_emit_set_zn_al();
+                return 1;
+            }
+        case TSX:
+            {
+                jit_emit_load_al(CPU_OFFSET(stackPointer));
+                jit_emit_store_al(reg);
+                jit_emit_set_zn_al();
+                return 1;
+            }
+        case TXS:
+            {
+                jit_emit_load_al(CPU_OFFSET(Xreq));
+                jit_emit_store_al(reg);
+                return 1;
+            }
+        case CLC: case CLD: case CLI: case CLV: case SEC: case SED: case SEI:
+            {
+                u8 flag = code == CLC || code == SEC ? Carry :
+                    code == CLD || code == SED ? DecimalMode :
+                    code == CLI || code == SEI ? DisableIterups : Overflow;
+                if(code == SEC || code == SED || code == SEI) { // or byte [rbx + flags], flag
+                    jit_emit8(0x80); jit_emit8(0x4B); jit_emit8(CPU_OFFSET(flags)); jit_emit8(flag);
+                } else { // and byte [rbx + flags], ~flag
+                    jit_emit8(0x80); jit_emit8(0x63); jit_emit8(CPU_OFFSET(flags)); jit_emit8(~flag);
+                }
+                return 1;
+            }
+        case NOP:
+            {
+                if(instruct->addressMode == IMP) return 1;
+            } break;
+    }
+    return 0;
+}
+
+static void
+jit_init() {
+
+    jit.code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(jit.code == MAP_FAILED) {
+        jit.code = NULL;
+        LOG("failed to map jit code memory, using interpreter");
+        cpuEngine = CPU_INTERPRETER;
+    }
+}
+
+static void
+jit_dispose() {
+
+    if(jit.blocksRun) {
+        LOG("jit ran %lu blocks, %lu instructions", jit.blocksRun, jit.instructionsRun);
+    }
+    if(jit.code) munmap(jit.code, JIT_CODE_SIZE);
+    free(jit.blocks);
+    free(jit.blockIndex);
+    jit = (struct Jit){ 0 };
+}
+
+// compiles block starting at pc, returns its index + 1
+static u32
+jit_compile(u16 pc, u32 prgOffset) {
+
+    if(jit.codeUsed + JIT_MAX_BLOCK_SIZE > JIT_CODE_SIZE) {
+        jit_flush();
+    }
+
+    if(jit.numBlocks == jit.blocksCapacity) {
+        jit.blocksCapacity = jit.blocksCapacity ? jit.blocksCapacity * 2 : 1024;
+        jit.blocks = realloc(jit.blocks, jit.blocksCapacity * sizeof(JitBlock));
+        ASSERT_MESSAGE(jit.blocks, "failed to allocate jit blocks");
+    }
+
+    JitBlock* block = &jit.blocks[jit.numBlocks];
+    *block = (JitBlock){ .code = NULL, .pc = pc };
+
+    u32 start = jit.codeUsed;
+    u16 addr = pc;
+    u8 pcStored = 0;
+
+    // blocks stay in the window they start from so all instructions are in same bank
+    DecodedInstruction* window = cartridge_decoded_window(pc);
+
+    jit_emit_prologue();
+
+    while(block->numInstructions < JIT_MAX_INSTRUCTIONS &&
+            (addr & ~(PRG_WINDOW_SIZE - 1)) == (pc & ~(PRG_WINDOW_SIZE - 1))) {
+
+        DecodedInstruction instruct = cpu_fetch_instruction(addr);
+        // operands continue in the next window
+        if(window[addr & (PRG_WINDOW_SIZE - 1)].length == DECODED_UNCACHED) break;
+        if(!jit_instruction_eligible(&instruct)) break;
+
+        u16 nextPc = addr + instruct.length;
+
+        pcStored = !jit_emit_inline(&instruct);
+        if(pcStored) {
+            jit_emit_call(&instruct, nextPc);
+        }
+
+        block->cycles += instruct.cycles;
+        block->maxCycles += instruct.cycles + JIT_MAX_EXTRA_CYCLES;
+        block->numInstructions += 1;
+        addr = nextPc;
+
+        if(jit_ends_block(instruct.instructionCode)) break;
+    }
+
+    if(block->numInstructions > 0) {
+        if(!pcStored) { // mov word [rbx + pc], addr
+            jit_emit8(0x66); jit_emit8(0xC7); jit_emit8(0x43); jit_emit8(CPU_OFFSET(pc));
+            jit_emit16(addr);
+        }
+        jit_emit_epilogue();
+        block->code = (jit_block_func)(void*)&jit.code[start];
+    } else {
+        jit.codeUsed = start;
+    }
+
+    jit.numBlocks += 1;
+    jit.blockIndex[prgOffset] = jit.numBlocks;
+    return jit.numBlocks;
+}
+
+// runs block both compiled and interpreted and compares results
+static void
+jit_run_differential(JitBlock* block) {
+
+    static u8 ramBefore[sizeof(ram)];
+    static u8 ramJit[sizeof(ram)];
+
+    cpu2ao3 before = cpu;
+    memcpy(ramBefore, ram, sizeof(ram));
+
+    cpu.cycles = block->cycles;
+    block->code();
+    cpu2ao3 jitCpu = cpu;
+    u8 jitStatus = cpu_status();
+    memcpy(ramJit, ram, sizeof(ram));
+
+    cpu = before;
+    memcpy(ram, ramBefore, sizeof(ram));
+
+    cpu.cycles = 0;
+    for(u32 i = 0; i < block->numInstructions; i++) {
+        DecodedInstruction instruct = cpu_fetch_instruction(cpu.pc);
+        cpu.pc += instruct.length;
+        cpu.cycles += instruct.cycles;
+        cpu_execute(instruct, 0);
+    }
+
+    if(jitCpu.pc != cpu.pc || jitCpu.accumReq != cpu.accumReq || jitCpu.Xreq != cpu.Xreq ||
+            jitCpu.Yreq != cpu.Yreq || jitCpu.stackPointer != cpu.stackPointer ||
+            jitStatus != cpu_status() || jitCpu.cycles != cpu.cycles ||
+            memcmp(ramJit, ram, sizeof(ram)) != 0) {
+
+        LOG("jit block 0x%04X (%d instructions) differs from interpreter", block->pc,
+                block->numInstructions);
+        LOG("jit         pc 0x%04X A 0x%02X X 0x%02X Y 0x%02X P 0x%02X SP 0x%02X cycles %d",
+                jitCpu.pc, jitCpu.accumReq, jitCpu.Xreq, jitCpu.Yreq, jitStatus,
+                jitCpu.stackPointer, jitCpu.cycles);
+        LOG("interpreter pc 0x%04X A 0x%02X X 0x%02X Y 0x%02X P 0x%02X SP 0x%02X cycles %d",
+                cpu.pc, cpu.accumReq, cpu.Xreq, cpu.Yreq, cpu_status(),
+                cpu.stackPointer, cpu.cycles);
+        ABORT("jit mismatch");
+    }
+}
+
+static u8
+jit_run_block() {
+
+    if(cpu.pc < PRG_WINDOW_START || !jit.code) return 0;
+
+    MapperHeader* head = &mapper.data.head;
+    if(!jit.blockIndex) {
+        jit.blockIndexLen = head->programMemoryLen;
+        jit.blockIndex = calloc(jit.blockIndexLen, sizeof(u32));
+        ASSERT_MESSAGE(jit.blockIndex, "failed to allocate jit block index");
+    }
+
+    DecodedInstruction* window = cartridge_decoded_window(cpu.pc);
+    if(!window) return 0;
+
+    u32 prgOffset = (u32)(window - head->decoded) + (cpu.pc & (PRG_WINDOW_SIZE - 1));
+    u32 index = jit.blockIndex[prgOffset];
+    if(index == 0 || jit.blocks[index - 1].pc != cpu.pc) {
+        index = jit_compile(cpu.pc, prgOffset);
+    }
+
+    JitBlock* block = &jit.blocks[index - 1];
+    if(!block->code || block->maxCycles > jit_cycle_budget()) return 0;
+
+    if(cpuEngine == CPU_JIT_DIFFERENTIAL) {
+        jit_run_differential(block);
+    } else {
+        cpu.cycles = block->cycles;
+        block->code();
+    }
+
+    cpu.instructionCount += block->numInstructions;
+    jit.blocksRun += 1;
+    jit.instructionsRun += block->numInstructions;
+    return 1;
+}
+
+#else
+
+static void
+jit_init() {
+    LOG("jit is only available on x86-64 linux, using interpreter");
+    cpuEngine = CPU_INTERPRETER;
+}
+
+static void
+jit_dispose() {
+}
+
+static u8
+jit_run_block() {
+    return 0;
+}
+
+#endif /* JIT_AVAILABLE */
+
+static void
+jit_flush() {
+    jit.codeUsed = 0;
+    jit.numBlocks = 0;
+    if(jit.blockIndex) memset(jit.blockIndex, 0, jit.blockIndexLen * sizeof(u32));
+}
+
+#endif /* JIT_H */
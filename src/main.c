@@ -17,10 +17,16 @@ const u32 SCREEN_WIDTH = 1800, SCREEN_HEIGHT = 1000;
 #include "cartridge.h"
 #include "bus.h"
 #include "cpu.h"
+#include "jit.h"
+#include "threaded.h"
 #include "ppu.h"
+#include "nes.h"
+#include "nestest.h"
 #include "input.h"
 #include "debugger.h"
 #include "apu.h"
+#include "pacing.h"
+#include "capture.h"
 
 SDL_Window *window;
 
@@ -50,13 +56,15 @@ initialize(char* rom) {
 
     assert(window);
     SDL_GL_CreateContext(window);
+    // frames are paced by pacing.h, vsync would hold swaps to the display rate
+    SDL_GL_SetSwapInterval(0);
 
-    apu_init();
-
-    // Load cartridge, init cpu, ppu and gamepad
+    // Load cartridge, init cpu, ppu, apu and gamepad. apu schedules its
+    // first event on the ppu, so it comes after ppu_init
     cartridge_load(rom);
     cpu_reset();
     ppu_init();
+    apu_init();
     debugger_init(window);
     gamepad_init();
 
@@ -64,8 +72,19 @@ initialize(char* rom) {
 }
 
 static void
-cleanup() {
+cleanup(char* cdlFile) {
     nk_sdl_shutdown();
+    if(cdlFile) {
+        mapperheader_cdl_save(&mapper.data.head, cdlFile);
+    }
+    jit_dispose();
+    threaded_dispose();
+    trace_dispose();
+    profile_report(PROFILE_REPORT_FILE);
+    profile_dispose();
+    apu_dispose();
+    // battery RAM is written back here
+    cartridge_dispose();
     //TODO clean everything up
     LOG("everything shutdown correctly...");
 }
@@ -73,22 +92,122 @@ cleanup() {
 int
 main(int argc, char** argv) {
 
-    if(argc != 2) {
+    char* rom = NULL;
+    char* nestestLog = NULL;
+    u8 bench = 0;
+    u64 traceRecords = 0;
+    u8 profiling = 0;
+    char* profileDbg = NULL;
+    char* cdlFile = NULL;
+    PacingMode pacingMode = PacingClock;
+    char* captureFile = NULL;
+    u32 captureFrames = 600;
+    for(i32 i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--nestest") == 0 && i + 2 < argc) {
+            rom = argv[++i];
+            nestestLog = argv[++i];
+        } else if(strcmp(argv[i], "--bench") == 0) {
+            bench = 1;
+        } else if(strcmp(argv[i], "--trace-decode") == 0 && i + 1 < argc) {
+            return trace_decode(argv[i + 1], stdout) ? 0 : 1;
+        } else if(strcmp(argv[i], "--trace") == 0) {
+            traceRecords = TRACE_DEFAULT_RECORDS;
+        } else if(strcmp(argv[i], "--trace-records") == 0 && i + 1 < argc) {
+            traceRecords = strtoull(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--profile") == 0) {
+            profiling = 1;
+        } else if(strcmp(argv[i], "--profile-dbg") == 0 && i + 1 < argc) {
+            profiling = 1;
+            profileDbg = argv[++i];
+        } else if(strcmp(argv[i], "--cdl") == 0 && i + 1 < argc) {
+            cdlFile = argv[++i];
+        } else if(strcmp(argv[i], "--save-dir") == 0 && i + 1 < argc) {
+            battery.directory = argv[++i];
+        } else if(strcmp(argv[i], "--save-seed") == 0 && i + 1 < argc) {
+            battery.seed = argv[++i];
+        } else if(strcmp(argv[i], "--pace") == 0 && i + 1 < argc) {
+            pacingMode = strcmp(argv[++i], "audio") == 0 ? PacingAudio : PacingClock;
+        } else if(strcmp(argv[i], "--audio-rate") == 0 && i + 1 < argc) {
+            apu.sampleRate = strtoul(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--audio-quality") == 0 && i + 1 < argc) {
+            i++;
+            apu.quality = strcmp(argv[i], "low") == 0 ? BlipLow :
+                strcmp(argv[i], "high") == 0 ? BlipHigh : BlipMedium;
+        } else if(strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            captureFile = argv[++i];
+        } else if(strcmp(argv[i], "--capture-frames") == 0 && i + 1 < argc) {
+            captureFrames = strtoul(argv[++i], NULL, 10);
+        } else if(strcmp(argv[i], "--jit") == 0) {
+            cpuEngine = CPU_JIT;
+        } else if(strcmp(argv[i], "--jit-diff") == 0) {
+            cpuEngine = CPU_JIT_DIFFERENTIAL;
+        } else if(strcmp(argv[i], "--threaded") == 0) {
+            cpuEngine = CPU_THREADED;
+        } else {
+            rom = argv[i];
+        }
+    }
+
+    if(!rom) {
         printf("specify lodable rom\n");
+        printf("usage: %s [--jit | --jit-diff | --threaded] [--trace | --trace-records n]\n"
+               "       [--profile | --profile-dbg file.dbg] [--cdl file.cdl]\n"
+               "       [--save-dir dir | --save-seed file.sav] [--pace clock | audio]\n"
+               "       [--audio-rate hz] [--audio-quality low | medium | high] rom\n", argv[0]);
+        printf("       %s --trace-decode trace.bin\n", argv[0]);
+        printf("       %s [--jit | --jit-diff | --threaded] --nestest nestest.nes nestest.log [--bench]\n", argv[0]);
+        printf("       %s --capture out.wav [--capture-frames n] [--audio-rate hz] rom\n", argv[0]);
+        return 1;
+    }
+
+    if(cpuEngine == CPU_THREADED) {
+        threaded_init();
+    } else if(cpuEngine != CPU_INTERPRETER) {
+        jit_init();
+    }
+
+    // checks the selected engine
+    if(nestestLog) {
+        i32 ret = nestest_run(rom, nestestLog, bench);
+        jit_dispose();
+        threaded_dispose();
+        trace_dispose();
+        return ret;
     }
 
-    initialize(argv[1]);
+    if(traceRecords) {
+        trace_enable(traceRecords);
+    }
+
+    if(captureFile) {
+        i32 ret = capture_run(rom, captureFile, captureFrames);
+        jit_dispose();
+        threaded_dispose();
+        trace_dispose();
+        return ret;
+    }
+
+    initialize(rom);
+
+    if(profiling) {
+        profile_enable(profileDbg);
+    }
+
+    // continue logging from earlier runs
+    if(cdlFile) {
+        mapperheader_cdl_load(&mapper.data.head, cdlFile);
+    }
 
     int running = 1;
 
     u32 updateCounter = 0;
-    u32 currentTime;
-    u32 lastTime = currentTime = SDL_GetTicks();
 
-    double targetDelta = 1.0 / 60.0;
+    pacing_init(pacingMode);
 
     while (running) {
 
+        u8 ranFrame = 0;
+
         // update game pad and run while esc key is pressed
         running = keystate_update();
 
@@ -107,7 +226,7 @@ main(int argc, char** argv) {
                     }
                     if(ppu.NMIGenerated == 1) {
                         ppu.NMIGenerated = 0;
-                        cpu_no_mask_iterrupt();
+                        cpu_no_mask_iterrupt(0);
                     }
 
                     updateCounter += 1;
@@ -118,25 +237,8 @@ main(int argc, char** argv) {
 
 #endif
                 if(step) {
-                    u8 updated = 0;
-                    do {
-                        ppu_clock();
-                        if(updateCounter % 3 == 0) {
-
-                            if(!ppu.oam.DMAactive) {
-                                updated = cpu_clock();
-                            } else {
-                                ppu_dma_oam(updateCounter);
-                            }
-
-                        }
-                        if(ppu.NMIGenerated == 1) {
-                            ppu.NMIGenerated = 0;
-                            cpu_no_mask_iterrupt();
-                        }
-
-                        updateCounter += 1;
-                    } while(updated != 1);
+                    // stepping always checks breakpoints
+                    while(nes_clock(&updateCounter, 1) != 1);
                     step = 0;
                 }
 
@@ -145,29 +247,21 @@ main(int argc, char** argv) {
 #endif
         } else { //normal update
 
-            currentTime = SDL_GetTicks();
-            double delta = (double)(currentTime - lastTime) / 1000.0;
-
-            if(delta > targetDelta) {
-                lastTime = currentTime;
-
+            // checks for trace, profiler and breakpoints only when some is on
+            if(cpu_hooks_active()) {
                 do {
-                    ppu_clock();
-                    if(updateCounter % 3 == 0) {
-                        if(!ppu.oam.DMAactive) {
-                            cpu_clock();
-                        } else {
-                            ppu_dma_oam(updateCounter);
-                        }
-                    }
-                    if(ppu.NMIGenerated == 1) {
-                        ppu.NMIGenerated = 0;
-                        cpu_no_mask_iterrupt();
-                    }
-                    updateCounter += 1;
+                    nes_clock(&updateCounter, 1);
+                } while(ppu.frameComplete == 0 && debug == 1);
+            } else {
+                do {
+                    nes_clock(&updateCounter, 0);
                 } while(ppu.frameComplete == 0 && debug == 1);
-                ppu.frameComplete = 0;
             }
+            ppu.frameComplete = 0;
+            ranFrame = 1;
+
+            apu_end_frame();
+            battery_update(SDL_GetTicks());
         }
 
         debugger_update();
@@ -184,7 +278,10 @@ main(int argc, char** argv) {
         debugger_draw();
 
         SDL_GL_SwapWindow(window);
+
+        // sleeps until next frame is due
+        pacing_wait(ranFrame);
     }
 
-    cleanup();
+    cleanup(cdlFile);
 }
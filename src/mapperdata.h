@@ -7,22 +7,87 @@
 
 char* notKnownOperand = "Outside of PRG mem";
 
-typedef struct DisasseblyTable {
-    char* disassebly; // PROG_ROM_SINGLE_SIZE of 20 sized blocks of strings
-} DisasseblyTable ;
+// PRG disassembly is made one page at a time when the debugger views it
+#define DISASSEMBLY_PAGE_SIZE   256
+#define DISASSEMBLY_LINE_LEN    20
+
+typedef struct DisassemblyPage {
+    // line for every byte that starts instruction, empty for operand bytes
+    char lines[DISASSEMBLY_PAGE_SIZE][DISASSEMBLY_LINE_LEN];
+} DisassemblyPage;
+
+// PRG rom is seen by the cpu through 8K windows at $8000-$FFFF
+#define PRG_WINDOW_START        0x8000
+#define PRG_WINDOW_SIZE         0x2000 // 8 K
+#define PRG_WINDOW_COUNT        4
+
+// length of instructions that cross the end of PRG window
+#define DECODED_UNCACHED        0xFF
+
+/* Instruction decoded from PRG rom, cached when first executed */
+typedef struct DecodedInstruction {
+    u16 operand;
+    u8  opcode;
+    u8  instructionCode;
+    u8  addressMode;
+    u8  cycles;
+    u8  length; // 0 when not decoded yet
+} DecodedInstruction;
+
+// Code/Data Logger flags, same layout as .cdl files of FCEUX and Mesen:
+// PRG rom bytes followed by CHR rom bytes, one byte of flags each
+typedef enum CdlPrgFlags {
+    CdlCode         = (1 << 0), // executed as opcode or operand
+    CdlData         = (1 << 1), // read by the cpu
+    CdlWindowMask   = (3 << 2), // PRG window byte was last accessed from ($8000, $A000, $C000, $E000)
+} CdlPrgFlags;
+
+typedef enum CdlChrFlags {
+    CdlDrawn        = (1 << 0), // fetched by ppu rendering
+    CdlRead         = (1 << 1), // read by the cpu through $2007
+} CdlChrFlags;
+
+// window bits of PRG cdl flags for cpu address
+#define CDL_WINDOW(ADDR) ((((ADDR) >> 13) & 3) << 2)
+
+// static disassembly of PRG (disassembler.h), bit per PRG byte in each
+typedef struct CodeAnalysis {
+    u8* starts;         // instruction found by following code
+    u8* covered;        // opcode or operand of found instruction
+    u8* labels;         // jump and branch targets
+    u8* subroutines;    // JSR targets and vectors
+} CodeAnalysis;
 
 /* Common data to mapper */
 typedef struct MapperHeader {
 
-    u8*                 characterMemory;
+    // CHR rom and PRG rom point to the shared rom image and are read only.
+    // characterMemory points to characterRam when cartridge has no CHR rom
+    const u8*           characterMemory;
     u32                 characterMemoryLen;
+    u8*                 characterRam;
 
-    u8*                 programMemory;
+    const u8*           programMemory;
     u32                 programMemoryLen;
 
-    // Table for each bank
     u32                 numPrgBanks;
-    DisasseblyTable*    tables;
+
+    // bit for every PRG byte that starts instruction (or .db), made on first
+    // disassembly request from the analysis. Pages are NULL until viewed
+    CodeAnalysis        analysis;
+    u8*                 instructionStarts;
+    DisassemblyPage**   disassemblyPages;
+
+    // One entry per PRG byte, windows point to the currently mapped 8K parts.
+    // Mapper clears windows on bank switch and they are resolved again on next fetch
+    DecodedInstruction* decoded;
+    DecodedInstruction* decodedWindows[PRG_WINDOW_COUNT];
+
+    // code/data log, one byte of CdlPrgFlags per PRG byte and CdlChrFlags per
+    // CHR byte. Ppu sets chrCdlAccess to flag ORed on CHR reads
+    u8*                 prgCdl;
+    u8*                 chrCdl;
+    u8                  chrCdlAccess;
 } MapperHeader;
 
 typedef struct Mapper0Data {
@@ -87,4 +152,58 @@ typedef struct Mapper1Data {
     u8      prgBankReqister;
 } Mapper1Data;
 #endif
+
+typedef struct Mapper4Data {
+
+    MapperHeader head;
+    u8*     programRAM;         // $6000-$7FFF: 8 KB PRG RAM
+
+    /* Bank select ($8000-$9FFE, even)
+     * 7  bit  0
+     * ---- ----
+     * CPxx xRRR
+     * ||    |||
+     * ||    +++- Bank reqister written on next $8001 write
+     * |+-------- PRG ROM bank mode (0: $8000 swappable, $C000 second last;
+     * |                             1: $C000 swappable, $8000 second last)
+     * +--------- CHR A12 inversion (0: 2 KB banks at $0000; 1: 2 KB banks at $1000)
+     */
+    u8      bankSelect;
+    // R0-R1 2 KB CHR, R2-R5 1 KB CHR, R6-R7 8 KB PRG banks
+    u8      bankReqisters[8];
+    // $A001, bit 7 PRG RAM enable and bit 6 write protect
+    u8      ramProtect;
+
+    // offsets to PRG memory for 8 KB windows at $8000-$FFFF and to CHR memory
+    // for 1 KB windows at $0000-$1FFF, updated on bank writes
+    u32     prgBanks[4];
+    u32     chrBanks[8];
+
+    // Scanline counter is not clocked dot by dot, it is advanced from the ppu
+    // dots passed since irqSyncDot before anything changes it and IRQ is
+    // scheduled as ppu event. irqClockCycle is the cycle counter is clocked
+    // on each rendered scanline, -1 when it is not clocked
+    u8      irqLatch;
+    u8      irqCounter;
+    u8      irqReload;
+    u8      irqEnabled;
+    i16     irqClockCycle;
+    u64     irqSyncDot;
+} Mapper4Data;
+
+// discrete.h
+typedef struct DiscreteLayout DiscreteLayout;
+
+typedef struct DiscreteData {
+
+    MapperHeader head;
+    const DiscreteLayout* layout;
+    // last value written to the latch
+    u8      reqister;
+
+    // offsets to PRG memory for 8 KB windows at $8000-$FFFF and to CHR memory
+    // for 1 KB windows at $0000-$1FFF
+    u32     prgBanks[4];
+    u32     chrBanks[8];
+} DiscreteData;
 #endif /* MAPPERDATA_H */
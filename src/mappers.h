@@ -7,137 +7,225 @@
 
 #include "mapperdata.h"
 #include "cpudata.h"
+#include "disassembler.h"
 
+// called on bank switch
 static inline void
-disassemblytable_write(MapperHeader* data, u32 addr /*prg mem space*/, char* str /*20 size*/) {
-
-    u32 bank = (u32)addr / PROG_ROM_SINGLE_SIZE;
-    ASSERT_MESSAGE(bank < data->numPrgBanks, "Failed to write to disassembly table 0x%04X", addr);
+mapperheader_invalidate_windows(MapperHeader* data) {
+    memset(data->decodedWindows, 0, sizeof(data->decodedWindows));
+}
 
-    u32 index = addr % PROG_ROM_SINGLE_SIZE;
-    ASSERT_MESSAGE(index < PROG_ROM_SINGLE_SIZE, "Failed to write to disassembly table 0x%04X", addr);
-    index *= 20;
+// drops disassembly, it is made again on next request
+static void
+mapperheader_disassembly_reset(MapperHeader* data) {
 
-    memcpy(&data->tables[bank].disassebly[index], str, sizeof(char) * 20);
+    if(data->disassemblyPages) {
+        for(u32 i = 0; i < data->programMemoryLen / DISASSEMBLY_PAGE_SIZE; i++) {
+            free(data->disassemblyPages[i]);
+        }
+    }
+    free(data->disassemblyPages);
+    free(data->instructionStarts);
+    data->disassemblyPages = NULL;
+    data->instructionStarts = NULL;
 }
 
-static DisasseblyTable*
-disassemblytables_get(u32 banks) {
+// Byte that is not part of found code is shown as .db when code/data log has
+// seen it only read as data or when decoding it would run into found code
+static u8
+mapperheader_disassembly_is_data(MapperHeader* data, u32 pos) {
 
-    u32 datasize = sizeof(char) * 20 * PROG_ROM_SINGLE_SIZE;
-    DisasseblyTable* ret = calloc( (sizeof(DisasseblyTable) + datasize) * banks, 1);
+    if(bitmap_get(data->analysis.starts, pos)) return 0;
+    if((data->prgCdl[pos] & (CdlCode | CdlData)) == CdlData) return 1;
 
-    char* datastart = (char*)&ret[banks];
-    for(u32 i = 0; i < banks; i++) {
-        ret[i].disassebly = datastart + (datasize * i);
+    u32 length = 1 + addressModeOperandBytes[instructionTable[data->programMemory[pos]].addressMode];
+    if(pos + length > data->programMemoryLen) return 1;
+    for(u32 i = 1; i < length; i++) {
+        if(bitmap_get(data->analysis.covered, pos + i)) return 1;
     }
+    return 0;
+}
+
+// Marks where instructions start. Code found by the static disassembler is
+// taken as is and gaps between it are decoded linearly
+static void
+mapperheader_find_instruction_starts(MapperHeader* data) {
+
+    if(!data->analysis.starts) disassembler_analyze(data);
+
+    data->instructionStarts = calloc(data->programMemoryLen / 8, sizeof(u8));
+    data->disassemblyPages = calloc(data->programMemoryLen / DISASSEMBLY_PAGE_SIZE,
+            sizeof(DisassemblyPage*));
+    ASSERT_MESSAGE(data->instructionStarts && data->disassemblyPages, "failed to allocate disassembly");
+
+    for(u32 i = 0; i < data->programMemoryLen;) {
 
-    return ret;
+        u32 length = 1;
+        if(!mapperheader_disassembly_is_data(data, i)) {
+            length += addressModeOperandBytes[instructionTable[data->programMemory[i]].addressMode];
+        }
+
+        bitmap_set(data->instructionStarts, i);
+        i += length;
+    }
 }
 
-static inline char*
-disassemblytable_read(MapperHeader* data, u32 addr) {
+static void
+mapperheader_disassemble_page(MapperHeader* data, DisassemblyPage* page, u32 pageStart) {
+
+    for(u32 i = 0; i < DISASSEMBLY_PAGE_SIZE; i++) {
+
+        u32 pos = pageStart + i;
+        char* line = page->lines[i];
+        u8 opcode = data->programMemory[pos];
+
+        if(!bitmap_get(data->instructionStarts, pos)) {
+            line[0] = '\0';
+        } else if(mapperheader_disassembly_is_data(data, pos)) {
+            snprintf(line, DISASSEMBLY_LINE_LEN, ".db 0x%02X", opcode);
+        } else {
+            Instruction instruction = instructionTable[opcode];
+            u8 operandBytes = addressModeOperandBytes[instruction.addressMode];
+
+            if(operandBytes == 0) {
+                snprintf(line, DISASSEMBLY_LINE_LEN, "%s ", cpuInstructionStrings[opcode]);
+            } else {
+                u16 operand = data->programMemory[pos + 1];
+                if(operandBytes == 2) operand |= data->programMemory[pos + 2] << 8;
+                snprintf(line, DISASSEMBLY_LINE_LEN, "%s 0x%04X", cpuInstructionStrings[opcode], operand);
+            }
+        }
+    }
+}
 
-    u32 bank = (u32)addr / PROG_ROM_SINGLE_SIZE;
-    ASSERT_MESSAGE(bank < data->numPrgBanks, "Failed to read from disassembly table 0x%04X", addr);
-    u32 index = addr % PROG_ROM_SINGLE_SIZE;
-    ASSERT_MESSAGE(index < PROG_ROM_SINGLE_SIZE, "Failed to read from disassembly table 0x%04X", addr);
-    index *= 20;
+// 1 if PRG byte starts instruction or .db line
+static u8
+mapperheader_instruction_start(MapperHeader* data, u32 addr /*prg mem space*/) {
 
-    return &data->tables[bank].disassebly[index];
+    if(!data->instructionStarts) mapperheader_find_instruction_starts(data);
+    return bitmap_get(data->instructionStarts, addr) != 0;
 }
 
+// disassembly line for PRG byte, empty if it is not start of an instruction
+static char*
+mapperheader_disassembly(MapperHeader* data, u32 addr /*prg mem space*/) {
+
+    ASSERT_MESSAGE(addr < data->programMemoryLen, "Failed to read disassembly 0x%04X", addr);
+
+    if(!data->instructionStarts) mapperheader_find_instruction_starts(data);
+
+    u32 pageIndex = addr / DISASSEMBLY_PAGE_SIZE;
+    DisassemblyPage* page = data->disassemblyPages[pageIndex];
+    if(!page) {
+        page = data->disassemblyPages[pageIndex] = malloc(sizeof(DisassemblyPage));
+        ASSERT_MESSAGE(page, "failed to allocate disassembly page");
+        mapperheader_disassemble_page(data, page, pageIndex * DISASSEMBLY_PAGE_SIZE);
+    }
+
+    return page->lines[addr % DISASSEMBLY_PAGE_SIZE];
+}
 
 static void
-mapperheader_init(MapperHeader* data, u8* progMem, u8* charMem) {
+mapperheader_init(MapperHeader* data, const u8* progMem, const u8* charMem) {
 
-    data->programMemory = calloc(cartridge.numProgramRoms, PROG_ROM_SINGLE_SIZE);
+    data->programMemory = progMem;
     data->programMemoryLen = cartridge.numProgramRoms * PROG_ROM_SINGLE_SIZE;
 
     if(cartridge.numCharacterRoms) {
-        data->characterMemory = calloc(cartridge.numCharacterRoms, CHAR_ROM_SINGLE_SIZE);
+        data->characterMemory = charMem;
         data->characterMemoryLen = cartridge.numCharacterRoms * CHAR_ROM_SINGLE_SIZE;
     } else {
-        data->characterMemory = calloc(1, CHAR_ROM_SINGLE_SIZE);
+        data->characterRam = calloc(1, CHAR_ROM_SINGLE_SIZE);
+        data->characterMemory = data->characterRam;
         data->characterMemoryLen = CHAR_ROM_SINGLE_SIZE;
     }
 
-    memcpy(data->programMemory, progMem,
-            cartridge.numProgramRoms * PROG_ROM_SINGLE_SIZE);
-    memcpy(data->characterMemory, charMem,
-            cartridge.numCharacterRoms * CHAR_ROM_SINGLE_SIZE);
-
     data->numPrgBanks = cartridge.numProgramRoms;
 
-    data->tables = disassemblytables_get(data->numPrgBanks);
-
-    /* init disassemblytable */
-    char codestr[20];
-    for(u32 i = 0; i < data->programMemoryLen; i++) {
+    data->decoded = calloc(data->programMemoryLen, sizeof(DecodedInstruction));
+    mapperheader_invalidate_windows(data);
 
-        u32 pos = i;
-        u8 opcode = data->programMemory[i];
+    data->prgCdl = calloc(data->programMemoryLen, sizeof(u8));
+    data->chrCdl = calloc(data->characterMemoryLen, sizeof(u8));
+    data->chrCdlAccess = CdlDrawn;
+}
 
-        Instruction instruction = instructionTable[opcode];
-        u16 low = 0x0;
-        u16 high = 0x0;
+void
+mapperheader_dispose(MapperHeader* data) {
 
-        u32 instLen = strlen(cpuInstructionStrings[opcode]);
-        memcpy(codestr ,cpuInstructionStrings[opcode], instLen);
+    free(data->characterRam);
+    mapperheader_disassembly_reset(data);
+    disassembler_dispose(data);
+    free(data->decoded);
+    free(data->prgCdl);
+    free(data->chrCdl);
 
-        codestr[instLen] = ' ';
+    memset(data, 0 ,sizeof *data);
+}
 
-        if(instruction.addressMode == ABS ||                // fetch 2 addresses
-                instruction.addressMode == ABSX ||
-                instruction.addressMode == ABSY ||
-                instruction.addressMode == IND) {
+// writes code/data log as .cdl file, CHR part only when cartridge has CHR rom
+static u8
+mapperheader_cdl_save(MapperHeader* data, const char* path) {
 
-            i += 1;
-            if(i >= data->programMemoryLen) break;
-            low = data->programMemory[i];
+    FILE* file = fopen(path, "wb");
+    if(!file) {
+        LOG("failed to open cdl file %s", path);
+        return 0;
+    }
 
-            i += 1;
-            if(i >= data->programMemoryLen) break;
-            high = data->programMemory[i];
-        } else if( instruction.addressMode == IMP || instruction.addressMode == ACCUM) {
-            /* fetch 0 addresses */
-            codestr[instLen + 1] = 0;
-            // write disassembled instruction
-            disassemblytable_write(data, pos, codestr);
-            continue;
-        }
+    u32 chrLen = cartridge.numCharacterRoms * CHAR_ROM_SINGLE_SIZE;
+    fwrite(data->prgCdl, sizeof(u8), data->programMemoryLen, file);
+    fwrite(data->chrCdl, sizeof(u8), chrLen, file);
+    fclose(file);
 
-        else // fetch low adress (1 address)
-        {
-            i += 1;
-            if(i >= data->programMemoryLen) break;
-            low = data->programMemory[i];
-        }
+    LOG("code/data log written to %s", path);
+    return 1;
+}
 
-        u16 holeAddr = (high << 8) | low;
-        char temp[32];
+// ORs flags from .cdl file to the log, disassembly is made again with them
+static u8
+mapperheader_cdl_load(MapperHeader* data, const char* path) {
 
-        sprintf(temp, "0x%04X", holeAddr);
+    FILE* file = fopen(path, "rb");
+    if(!file) return 0;
 
-        int hexStringSize = strlen(temp) + 1;
-        memcpy(&codestr[instLen + 1], temp, hexStringSize);
+    u32 chrLen = cartridge.numCharacterRoms * CHAR_ROM_SINGLE_SIZE;
+    u8* flags = malloc(data->programMemoryLen + chrLen);
+    size_t numRead = fread(flags, sizeof(u8), data->programMemoryLen + chrLen, file);
+    fclose(file);
 
-        disassemblytable_write(data, pos, codestr);
+    if(numRead != data->programMemoryLen + chrLen) {
+        LOG("cdl file %s does not match the rom", path);
+        free(flags);
+        return 0;
     }
-}
 
-void
-mapperheader_dispose(MapperHeader* data) {
-
-    free(data->programMemory);
-    free(data->characterMemory);
-    free(data->tables);
+    for(u32 i = 0; i < data->programMemoryLen; i++) data->prgCdl[i] |= flags[i];
+    for(u32 i = 0; i < chrLen; i++) data->chrCdl[i] |= flags[data->programMemoryLen + i];
+    free(flags);
 
-    memset(data, 0 ,sizeof *data);
+    mapperheader_disassembly_reset(data);
+    LOG("code/data log loaded from %s", path);
+    return 1;
 }
 
-
 #include "nrom.h"
 #include "mmc1.h"
+#include "mmc3.h"
+#include "discrete.h"
+
+// Supported mappers: iNES mapper number, name of the struct Mapper and name of
+// the MapperData member, which is also the prefix of its read functions.
+// Cartridge reads switch over this list so the mapper functions are called
+// directly
+#define MAPPER_LIST(MAPPER)                 \
+    MAPPER(0,  mapper0,  mapper0)           \
+    MAPPER(1,  mapper1,  mapper1)           \
+    MAPPER(2,  mapper2,  discrete)          \
+    MAPPER(3,  mapper3,  discrete)          \
+    MAPPER(4,  mapper4,  mapper4)           \
+    MAPPER(7,  mapper7,  discrete)          \
+    MAPPER(11, mapper11, discrete)          \
+    MAPPER(66, mapper66, discrete)
 
 #endif /* MAPPERS_H */
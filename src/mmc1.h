@@ -23,11 +23,11 @@
 #define MAP1_PRGBANK_END        0xFFFF
 
 void
-mapper1_init(Mapper1Data* data, u8* progMem, u8* charMem) {
+mapper1_init(Mapper1Data* data, const u8* progMem, const u8* charMem) {
 
     mapperheader_init(&data->head, progMem, charMem);
 
-    data->programRAM = calloc(MAP1_RAM_SIZE, 1);
+    data->programRAM = cartridge_prg_ram_alloc(MAP1_RAM_SIZE);
     data->controlReqister = 0xF;
 }
 
@@ -87,12 +87,17 @@ u32 _mapper1_get_prg_addr(Mapper1Data* data, u16 addr) {
     return numeric_max_u32;
 }
 
+u32
+mapper1_prg_offset(Mapper1Data* data, u16 addr) {
+    return _mapper1_get_prg_addr(data, addr);
+}
+
 char*
 mapper1_disassemble(Mapper1Data* data, u16 addr) {
 
     u32 address =_mapper1_get_prg_addr(data, addr);
     if(address == numeric_max_u32) return notKnownOperand;
-    return disassemblytable_read(&data->head, address);
+    return mapperheader_disassembly(&data->head, address);
 }
 
 
@@ -100,12 +105,12 @@ void
 mapper1_dispose(Mapper1Data* data) {
 
     mapperheader_dispose(&data->head);
-    free(data->programRAM);
+    cartridge_prg_ram_free(data->programRAM);
 
     memset(data, 0 ,sizeof *data);
 }
 
-u8
+static inline u8
 mapper1_cpu_read(Mapper1Data* data, u16 addr) {
 
     if(addr < MAP1_RAM_START ) return 0; // Nova the squirrel fix
@@ -121,6 +126,7 @@ mapper1_cpu_read(Mapper1Data* data, u16 addr) {
 
     u32 address =_mapper1_get_prg_addr(data, addr);
     if(address == numeric_max_u32) ABORT("MMC1 prg mem invalid address 0x%04X", address);
+    data->head.prgCdl[address] |= CdlData | CDL_WINDOW(addr);
     return data->head.programMemory[address];
 }
 
@@ -156,6 +162,7 @@ mapper1_cpu_write(Mapper1Data* data, u16 addr, u8 val) {
 
         data->controlReqister |= 0xC;
         data->shiftReqister = 0x10;
+        mapperheader_invalidate_windows(&data->head);
         return;
     }
 
@@ -200,6 +207,8 @@ mapper1_cpu_write(Mapper1Data* data, u16 addr, u8 val) {
             ABORT("MMC1 address range not covered");
         }
 
+        // PRG bank mode or bank might have changed
+        mapperheader_invalidate_windows(&data->head);
 
         data->shiftReqister = 0x10;
     } else {
@@ -215,7 +224,7 @@ mapper1_cpu_write(Mapper1Data* data, u16 addr, u8 val) {
     }
 }
 
-u8
+static inline u8
 mapper1_ppu_read(Mapper1Data* data, u16 addr) {
 
     u8 chrBankMode = (data->controlReqister & Map1CHRBankMode) >> 0x4;
@@ -226,6 +235,7 @@ mapper1_ppu_read(Mapper1Data* data, u16 addr) {
         u8 bank = data->chrBank0reqister & 0x1E;
         u16 address = (bank * 0x2000 /*8 kb*/) + addr;
         ASSERT_MESSAGE(address < data->head.characterMemoryLen, "MMC1 prg mem invalid address");
+        data->head.chrCdl[address] |= data->head.chrCdlAccess;
         return data->head.characterMemory[address];
         //4kb mode
     } else {
@@ -233,10 +243,12 @@ mapper1_ppu_read(Mapper1Data* data, u16 addr) {
         if(addr < 0x1000) {
             u16 address = data->chrBank0reqister * 0x1000 /*4 kb*/ + addr;
             ASSERT_MESSAGE(address < data->head.characterMemoryLen, "MMC1 prg mem invalid address");
+            data->head.chrCdl[address] |= data->head.chrCdlAccess;
             return data->head.characterMemory[address];
         } else {
             u16 address = (data->chrBank1reqister * 0x1000 /*4 kb*/)  + (addr - 0x1000 /*4 kb*/);
             ASSERT_MESSAGE(address < data->head.characterMemoryLen, "MMC1 prg mem invalid address");
+            data->head.chrCdl[address] |= data->head.chrCdlAccess;
             return data->head.characterMemory[address];
         }
     }
@@ -246,7 +258,7 @@ void
 mapper1_ppu_write(Mapper1Data* data, u16 addr, u8 val) {
 
     ASSERT_MESSAGE(addr < data->head.characterMemoryLen, "invalid write in mmc1");
-    data->head.characterMemory[addr] = val;
+    if(data->head.characterRam) data->head.characterRam[addr] = val;
 }
 
 struct Mapper mapper1 = {
@@ -256,6 +268,7 @@ struct Mapper mapper1 = {
     .ppu_write_cartridge    = (ppu_write_func)mapper1_ppu_write,
     .mapper_init            = (mapper_init_func)mapper1_init,
     .mapper_dispose         = (mapper_dispose_func)mapper1_dispose,
+    .cpu_prg_offset         = (prg_offset_func)mapper1_prg_offset,
     .cpu_peak_cartridge     = (peak_func)mapper1_cpu_peak,
     .mapper_disasseble      = (disasseble_func)mapper1_disassemble
 };
@@ -0,0 +1,317 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+// ppu.h
+static u64 ppu_dot();
+static void ppu_schedule_event(u64 dot);
+static i16 ppu_a12_rise_cycle();
+
+#ifndef MMC3_H
+#define MMC3_H
+
+// MMC3 (TxROM)
+//
+// Reads go through bank tables that are rebuilt on bank writes, so there is no
+// bank mode logic on the access. Scanline counter is clocked by A12 rises of
+// ppu pattern fetches, which happen at the same cycle of every rendered
+// scanline for a given ppu config (ppu_a12_rise_cycle). Counter is advanced
+// by counting those cycles between two ppu dots and the dot it reaches zero
+// is scheduled as ppu event, so ppu does nothing per CHR fetch.
+
+#define MAP4_RAM_START          0x6000
+#define MAP4_RAM_END            0x7FFF
+#define MAP4_RAM_SIZE           0x2000
+
+#define MAP4_PRG_BANK_SIZE      0x2000 // 8 K
+#define MAP4_CHR_BANK_SIZE      0x400  // 1 K
+
+#define MAP4_RAM_ENABLE         0x80
+#define MAP4_RAM_WRITE_PROTECT  0x40
+
+// scanlines -1 to 239 clock the counter
+#define MAP4_CLOCKS_PER_FRAME   241
+#define MAP4_SCANLINE_DOTS      341
+#define MAP4_FRAME_DOTS         (262 * MAP4_SCANLINE_DOTS)
+
+static void
+mapper4_update_banks(Mapper4Data* data) {
+
+    u32 numPrgBanks = data->head.programMemoryLen / MAP4_PRG_BANK_SIZE;
+    u32 secondLast = (numPrgBanks - 2) * MAP4_PRG_BANK_SIZE;
+    u32 last = (numPrgBanks - 1) * MAP4_PRG_BANK_SIZE;
+    u32 r6 = (data->bankReqisters[6] % numPrgBanks) * MAP4_PRG_BANK_SIZE;
+    u32 r7 = (data->bankReqisters[7] % numPrgBanks) * MAP4_PRG_BANK_SIZE;
+
+    if(data->bankSelect & 0x40) {
+        data->prgBanks[0] = secondLast;
+        data->prgBanks[2] = r6;
+    } else {
+        data->prgBanks[0] = r6;
+        data->prgBanks[2] = secondLast;
+    }
+    data->prgBanks[1] = r7;
+    data->prgBanks[3] = last;
+
+    // 2 KB banks ignore the low bit
+    u8 chr[8] = {
+        data->bankReqisters[0] & 0xFE, data->bankReqisters[0] | 0x1,
+        data->bankReqisters[1] & 0xFE, data->bankReqisters[1] | 0x1,
+        data->bankReqisters[2], data->bankReqisters[3],
+        data->bankReqisters[4], data->bankReqisters[5]
+    };
+    u32 numChrBanks = data->head.characterMemoryLen / MAP4_CHR_BANK_SIZE;
+    u8 inversion = data->bankSelect & 0x80 ? 4 : 0;
+    for(u32 i = 0; i < 8; i++) {
+        data->chrBanks[i ^ inversion] = (chr[i] % numChrBanks) * MAP4_CHR_BANK_SIZE;
+    }
+
+    mapperheader_invalidate_windows(&data->head);
+}
+
+// counter clocks before ppu dot
+static u64
+mapper4_clocks_before(Mapper4Data* data, u64 dot) {
+
+    u64 clocks = (dot / MAP4_FRAME_DOTS) * MAP4_CLOCKS_PER_FRAME;
+    u32 frameDot = dot % MAP4_FRAME_DOTS;
+
+    if(frameDot > (u32)data->irqClockCycle) {
+        u32 lines = (frameDot - data->irqClockCycle - 1) / MAP4_SCANLINE_DOTS + 1;
+        clocks += lines < MAP4_CLOCKS_PER_FRAME ? lines : MAP4_CLOCKS_PER_FRAME;
+    }
+    return clocks;
+}
+
+// ppu dot of counter clock, clocks are numbered like in mapper4_clocks_before
+static u64
+mapper4_clock_dot(Mapper4Data* data, u64 clock) {
+
+    return (clock / MAP4_CLOCKS_PER_FRAME) * MAP4_FRAME_DOTS +
+        (clock % MAP4_CLOCKS_PER_FRAME) * MAP4_SCANLINE_DOTS + data->irqClockCycle;
+}
+
+// advances counter to current ppu dot, done before counter or the way it is
+// clocked changes
+static void
+mapper4_irq_sync(Mapper4Data* data) {
+
+    u64 now = ppu_dot();
+
+    if(data->irqClockCycle >= 0 && now > data->irqSyncDot) {
+
+        u64 clocks = mapper4_clocks_before(data, now) - mapper4_clocks_before(data, data->irqSyncDot);
+
+        if(clocks) {
+            // counter is reloaded from latch when it is 0, otherwise decremented
+            if(data->irqCounter == 0 || data->irqReload) {
+                data->irqCounter = data->irqLatch;
+                data->irqReload = 0;
+            } else {
+                data->irqCounter--;
+            }
+            clocks--;
+
+            if(clocks > data->irqCounter) {
+                // counter goes from 0 to latch and back to 0 in latch + 1 clocks
+                u64 period = data->irqLatch + 1;
+                u64 phase = (clocks - data->irqCounter) % period;
+                data->irqCounter = phase ? period - phase : 0;
+            } else {
+                data->irqCounter -= clocks;
+            }
+        }
+    }
+
+    data->irqSyncDot = now;
+}
+
+// schedules ppu event for the clock that leaves counter to zero
+static void
+mapper4_irq_schedule(Mapper4Data* data) {
+
+    if(!data->irqEnabled || data->irqClockCycle < 0) {
+        ppu_schedule_event(0);
+        return;
+    }
+
+    u32 clocks = data->irqCounter;
+    if(data->irqCounter == 0 || data->irqReload) {
+        clocks = data->irqLatch + 1;
+    }
+
+    u64 clock = mapper4_clocks_before(data, data->irqSyncDot) + clocks - 1;
+    // event is on the dot after the clock
+    ppu_schedule_event(mapper4_clock_dot(data, clock) + 1);
+}
+
+void
+mapper4_ppu_config(Mapper4Data* data) {
+
+    mapper4_irq_sync(data);
+    data->irqClockCycle = ppu_a12_rise_cycle();
+    mapper4_irq_schedule(data);
+}
+
+void
+mapper4_ppu_event(Mapper4Data* data) {
+
+    mapper4_irq_sync(data);
+    if(data->irqEnabled && data->irqCounter == 0) {
+        cpu.irqLines |= IrqMapper;
+    }
+    mapper4_irq_schedule(data);
+}
+
+void
+mapper4_init(Mapper4Data* data, const u8* progMem, const u8* charMem) {
+
+    mapperheader_init(&data->head, progMem, charMem);
+
+    data->programRAM = cartridge_prg_ram_alloc(MAP4_RAM_SIZE);
+    data->ramProtect = MAP4_RAM_ENABLE;
+    data->irqClockCycle = -1;
+    mapper4_update_banks(data);
+}
+
+void
+mapper4_dispose(Mapper4Data* data) {
+
+    mapperheader_dispose(&data->head);
+    cartridge_prg_ram_free(data->programRAM);
+
+    memset(data, 0 ,sizeof *data);
+}
+
+u32
+mapper4_prg_offset(Mapper4Data* data, u16 addr) {
+
+    if(addr < PRG_WINDOW_START) return numeric_max_u32;
+    return data->prgBanks[(addr >> 13) & 0x3] + (addr & (MAP4_PRG_BANK_SIZE - 1));
+}
+
+char*
+mapper4_disassemble(Mapper4Data* data, u16 addr) {
+
+    u32 address = mapper4_prg_offset(data, addr);
+    if(address == numeric_max_u32) return notKnownOperand;
+    return mapperheader_disassembly(&data->head, address);
+}
+
+static inline u8
+mapper4_cpu_read(Mapper4Data* data, u16 addr) {
+
+    if(addr >= PRG_WINDOW_START) {
+        u32 address = data->prgBanks[(addr >> 13) & 0x3] + (addr & (MAP4_PRG_BANK_SIZE - 1));
+        data->head.prgCdl[address] |= CdlData | CDL_WINDOW(addr);
+        return data->head.programMemory[address];
+    }
+
+    if(addr >= MAP4_RAM_START && (data->ramProtect & MAP4_RAM_ENABLE)) {
+        return data->programRAM[addr - MAP4_RAM_START];
+    }
+    return 0;
+}
+
+u8
+mapper4_cpu_peak(Mapper4Data* data, u16 addr, u8* valid) {
+
+    if(addr >= PRG_WINDOW_START) {
+        if(valid) *valid = 1;
+        return data->head.programMemory[mapper4_prg_offset(data, addr)];
+    }
+    if(addr >= MAP4_RAM_START) {
+        if(valid) *valid = 1;
+        return data->programRAM[addr - MAP4_RAM_START];
+    }
+    return 0;
+}
+
+void
+mapper4_cpu_write(Mapper4Data* data, u16 addr, u8 val) {
+
+    if(address_is_between(addr, MAP4_RAM_START, MAP4_RAM_END)) {
+        if((data->ramProtect & (MAP4_RAM_ENABLE | MAP4_RAM_WRITE_PROTECT)) == MAP4_RAM_ENABLE) {
+            data->programRAM[addr - MAP4_RAM_START] = val;
+        }
+        return;
+    }
+    if(addr < PRG_WINDOW_START) return;
+
+    // reqister is selected by the 8K range and whether address is even or odd
+    u8 odd = addr & 0x1;
+    switch(addr & 0xE000) {
+        case 0x8000:
+            {
+                if(odd) {
+                    data->bankReqisters[data->bankSelect & 0x7] = val;
+                } else {
+                    data->bankSelect = val;
+                }
+                mapper4_update_banks(data);
+            } break;
+        case 0xA000:
+            {
+                if(odd) {
+                    data->ramProtect = val;
+                } else {
+                    cartridge.mirrorType = val & 0x1 ? HORIZONTAL : VERTICAL;
+                }
+            } break;
+        case 0xC000:
+            {
+                mapper4_irq_sync(data);
+                if(odd) {
+                    // counter is reloaded on next clock
+                    data->irqCounter = 0;
+                    data->irqReload = 1;
+                } else {
+                    data->irqLatch = val;
+                }
+                mapper4_irq_schedule(data);
+            } break;
+        case 0xE000:
+            {
+                mapper4_irq_sync(data);
+                if(odd) {
+                    data->irqEnabled = 1;
+                } else {
+                    // disabling also acknowledges pending IRQ
+                    data->irqEnabled = 0;
+                    cpu.irqLines &= ~IrqMapper;
+                }
+                mapper4_irq_schedule(data);
+            } break;
+    }
+}
+
+static inline u8
+mapper4_ppu_read(Mapper4Data* data, u16 addr) {
+
+    u32 address = data->chrBanks[(addr >> 10) & 0x7] + (addr & (MAP4_CHR_BANK_SIZE - 1));
+    data->head.chrCdl[address] |= data->head.chrCdlAccess;
+    return data->head.characterMemory[address];
+}
+
+void
+mapper4_ppu_write(Mapper4Data* data, u16 addr, u8 val) {
+
+    u32 address = data->chrBanks[(addr >> 10) & 0x7] + (addr & (MAP4_CHR_BANK_SIZE - 1));
+    if(data->head.characterRam) data->head.characterRam[address] = val;
+}
+
+struct Mapper mapper4 = {
+    .cpu_read_cartridge     = (cpu_read_func)mapper4_cpu_read,
+    .cpu_write_cartridge    = (cpu_write_func)mapper4_cpu_write,
+    .ppu_read_cartridge     = (ppu_read_func)mapper4_ppu_read,
+    .ppu_write_cartridge    = (ppu_write_func)mapper4_ppu_write,
+    .mapper_init            = (mapper_init_func)mapper4_init,
+    .mapper_dispose         = (mapper_dispose_func)mapper4_dispose,
+    .cpu_prg_offset         = (prg_offset_func)mapper4_prg_offset,
+    .ppu_config             = (ppu_hook_func)mapper4_ppu_config,
+    .ppu_event              = (ppu_hook_func)mapper4_ppu_event,
+    .cpu_peak_cartridge     = (peak_func)mapper4_cpu_peak,
+    .mapper_disasseble      = (disasseble_func)mapper4_disassemble
+};
+
+#endif /* MMC3_H */
@@ -0,0 +1,39 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef NES_H
+#define NES_H
+
+#include "defs.h"
+#include "cpu.h"
+#include "ppu.h"
+
+// one ppu dot, cpu runs every third dot. Returns 1 when cpu started an
+// instruction. hooked is constant so both loops get their own copy.
+// Main loop, nestest (nestest.h) and audio capture (capture.h) all run the
+// system through this
+static FORCE_INLINE u8
+nes_clock(u32* updateCounter, u8 hooked) {
+
+    u8 updated = 0;
+    ppu_clock();
+    if(*updateCounter % 3 == 0) {
+
+        if(!ppu.oam.DMAactive) {
+            updated = hooked ? cpu_clock_hooked() : cpu_clock();
+        } else {
+            ppu_dma_oam(*updateCounter);
+        }
+
+    }
+    if(ppu.NMIGenerated == 1) {
+        ppu.NMIGenerated = 0;
+        cpu_no_mask_iterrupt(hooked);
+    }
+
+    *updateCounter += 1;
+    return updated;
+}
+
+#endif /* NES_H */
@@ -0,0 +1,257 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef NESTEST_H
+#define NESTEST_H
+
+#include <time.h>
+#include "defs.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "nes.h"
+#include "trace.h"
+
+// Headless cpu check against nestest reference log
+// http://www.qmtpro.com/~nes/misc/nestest.log
+//
+// Runs nestest.nes in automation mode (from $C000) without window or audio,
+// with the selected cpu engine through nes_clock like the main loop. Pc,
+// opcode, reqisters and cycle count of each instruction have to match the
+// reference line of the instruction count so far.
+// Interpreter streams the state through the trace (trace.h), every record is
+// compared as it is written. Trace keeps jit and threaded engines from running
+// blocks, so with those the cpu state is compared whenever the cpu is between
+// blocks and lines inside a block are not compared (--jit-diff checks those
+// against the interpreter).
+// Log is parsed before the run so --bench times only the emulation. Stops at
+// first line that differs and prints the reference lines before it and our
+// line in trace_format.
+
+#define NESTEST_START_PC        0xC000
+#define NESTEST_START_CYCLE     7
+#define NESTEST_START_STATUS    0x24
+#define NESTEST_START_SP        0xFD
+#define NESTEST_CONTEXT         8
+#define NESTEST_LINE_LEN        128
+// reference log is about 9000 lines
+#define NESTEST_INITIAL_LINES   16384
+// only the newest record is read
+#define NESTEST_TRACE_RECORDS   1024
+
+typedef struct NestestState {
+    u32 pc;
+    u32 opcode;
+    u32 accumReq;
+    u32 Xreq;
+    u32 Yreq;
+    u32 status;
+    u32 stackPointer;
+    u64 cycle;
+} NestestState;
+
+// parsed reference log, text is kept for printing the context
+typedef struct NestestLog {
+    NestestState*   states;
+    char*           lines;      // NESTEST_LINE_LEN * 2 per state
+    u64             count;
+    u64             capacity;
+} NestestLog;
+
+// parses nestest log line, works for both reference and trace_format lines so
+// --trace-decode output of an earlier run can be used as reference
+static u8
+nestest_parse_line(const char* line, NestestState* state) {
+
+    if(sscanf(line, "%4x %2x", &state->pc, &state->opcode) != 2) return 0;
+
+    const char* regs = strstr(line, "A:");
+    if(!regs || sscanf(regs, "A:%x X:%x Y:%x P:%x SP:%x", &state->accumReq,
+                &state->Xreq, &state->Yreq, &state->status, &state->stackPointer) != 5) {
+        return 0;
+    }
+
+    const char* cycle = strstr(line, "CYC:");
+    if(!cycle || sscanf(cycle, "CYC:%lu", &state->cycle) != 1) return 0;
+
+    return 1;
+}
+
+// name of first differing field or NULL
+static const char*
+nestest_compare(NestestState* ours, NestestState* reference) {
+    if(ours->pc != reference->pc)                     return "pc";
+    if(ours->opcode != reference->opcode)             return "opcode";
+    if(ours->accumReq != reference->accumReq)         return "A";
+    if(ours->Xreq != reference->Xreq)                 return "X";
+    if(ours->Yreq != reference->Yreq)                 return "Y";
+    if(ours->status != reference->status)             return "P";
+    if(ours->stackPointer != reference->stackPointer) return "SP";
+    if(ours->cycle != reference->cycle)               return "CYC";
+    return NULL;
+}
+
+static u8
+nestest_load_log(const char* logPath, NestestLog* log) {
+
+    FILE* file = fopen(logPath, "r");
+    if(!file) {
+        LOG("failed to open reference log %s", logPath);
+        return 0;
+    }
+
+    *log = (NestestLog){ 0 };
+
+    static char line[NESTEST_LINE_LEN * 2];
+    while(fgets(line, sizeof(line), file)) {
+
+        NestestState state;
+        if(!nestest_parse_line(line, &state)) continue;
+
+        if(log->count == log->capacity) {
+            log->capacity = log->capacity ? log->capacity * 2 : NESTEST_INITIAL_LINES;
+            log->states = realloc(log->states, log->capacity * sizeof(NestestState));
+            log->lines = realloc(log->lines, log->capacity * sizeof(line));
+            ASSERT_MESSAGE(log->states && log->lines, "failed to allocate nestest log");
+        }
+        log->states[log->count] = state;
+        memcpy(log->lines + log->count * sizeof(line), line, sizeof(line));
+        log->count++;
+    }
+    fclose(file);
+    return 1;
+}
+
+static void
+nestest_free_log(NestestLog* log) {
+    free(log->states);
+    free(log->lines);
+}
+
+static inline const char*
+nestest_log_line(NestestLog* log, u64 index) {
+    return log->lines + index * NESTEST_LINE_LEN * 2;
+}
+
+// record of the state before the next instruction, for engines that run
+// blocks without trace. Cycles left of the current instruction are counted in
+// so it can be taken right after the cpu started an instruction
+static void
+nestest_cpu_record(TraceRecord* record) {
+
+    *record = (TraceRecord) {
+        .cycle = cpu.totalCycles + cpu.cycles, .pc = cpu.pc,
+        .scanline = ppu.scanline, .dot = ppu.cycle,
+        .opcode = bus_peak8(cpu.pc, NULL),
+        .operand = { bus_peak8(cpu.pc + 1, NULL), bus_peak8(cpu.pc + 2, NULL) },
+        .accumReq = cpu.accumReq, .Xreq = cpu.Xreq, .Yreq = cpu.Yreq,
+        .status = cpu_status(), .stackPointer = cpu.stackPointer
+    };
+}
+
+static inline void
+nestest_record_state(const TraceRecord* record, NestestState* state) {
+
+    *state = (NestestState) {
+        .pc = record->pc, .opcode = record->opcode,
+        .accumReq = record->accumReq, .Xreq = record->Xreq, .Yreq = record->Yreq,
+        .status = record->status, .stackPointer = record->stackPointer,
+        .cycle = record->cycle
+    };
+}
+
+static inline double
+nestest_seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// returns process exit code, 0 when whole log matched
+static i32
+nestest_run(const char* rom, const char* logPath, u8 bench) {
+
+    NestestLog log;
+    if(!nestest_load_log(logPath, &log)) return 1;
+
+    cartridge_load(rom);
+    cpu_reset();
+    ppu_init_headless();
+
+    // automation mode starts after reset sequence
+    cpu.pc = NESTEST_START_PC;
+    cpu.cycles = 0;
+    cpu.totalCycles = NESTEST_START_CYCLE;
+    cpu.stackPointer = NESTEST_START_SP;
+    cpu_status_set(NESTEST_START_STATUS);
+    // ppu is clocked before the cpu on the first dot
+    ppu.cycle = NESTEST_START_CYCLE * 3 - 1;
+
+    u8 traced = cpuEngine == CPU_INTERPRETER;
+    if(traced) trace_enable(NESTEST_TRACE_RECORDS);
+
+    u8 hooked = cpu_hooks_active();
+    u64 startInstructions = cpu.instructionCount;
+    u64 startRecords = trace.written;
+    u64 executed = 0;
+    u32 updateCounter = 0;
+    TraceRecord ours;
+    NestestState state;
+    const char* field = NULL;
+
+    double start = nestest_seconds();
+
+    while(executed < log.count) {
+
+        if(traced) {
+            // record is written when the instruction starts
+            while(trace.written == startRecords + executed) {
+                while(!nes_clock(&updateCounter, hooked));
+            }
+            ours = trace.records[(startRecords + executed) & trace.mask];
+        } else {
+            nestest_cpu_record(&ours);
+        }
+
+        nestest_record_state(&ours, &state);
+        field = nestest_compare(&state, &log.states[executed]);
+        if(field) break;
+
+        if(traced) {
+            executed++;
+        } else {
+            // one instruction, or a block of them
+            while(!nes_clock(&updateCounter, hooked));
+            executed = cpu.instructionCount - startInstructions;
+        }
+    }
+
+    double elapsed = nestest_seconds() - start;
+
+    if(field) {
+        printf("nestest differs at line %lu (%s)\n", executed + 1, field);
+        u64 first = executed >= NESTEST_CONTEXT - 1 ? executed - (NESTEST_CONTEXT - 1) : 0;
+        for(u64 i = first; i < executed; i++) {
+            printf("      %s", nestest_log_line(&log, i));
+        }
+        char line[NESTEST_LINE_LEN];
+        trace_format(&ours, line, sizeof(line));
+        printf("ours  %s\n", line);
+        printf("log   %s", nestest_log_line(&log, executed));
+    } else {
+        printf("nestest matched %lu lines\n", log.count);
+    }
+    // nestest writes error codes of failed official and unofficial tests here
+    printf("result codes $02: 0x%02X $03: 0x%02X\n", ram[0x02], ram[0x03]);
+
+    if(bench) {
+        printf("%lu instructions in %.3f s, %.0f instructions/s\n",
+                executed, elapsed, elapsed > 0 ? executed / elapsed : 0.0);
+    }
+
+    nestest_free_log(&log);
+    return field ? 1 : 0;
+}
+
+#endif /* NESTEST_H */
@@ -12,7 +12,7 @@
 #define MAP0_PPU_DATA_SIZE      0x1FFF
 
 void
-mapper0_init(Mapper0Data* data, u8* progMem, u8* charMem) {
+mapper0_init(Mapper0Data* data, const u8* progMem, const u8* charMem) {
     mapperheader_init(&data->head, progMem, charMem);
 }
 
@@ -49,46 +49,60 @@ mapper0_disasseble(Mapper0Data* data, u16 addr) {
     else
         addr &= 0x7FFF; // if 2 rom capasity is 32K
 
-    return disassemblytable_read(&data->head, addr);
+    return mapperheader_disassembly(&data->head, addr);
 }
 
-u8
+u32
+mapper0_prg_offset(Mapper0Data* data, u16 addr) {
+
+    (void)data;
+    if(!address_is_between(addr, MAP0_START, MAP0_END)) return numeric_max_u32;
+
+    if(cartridge.numProgramRoms == 1)
+        addr &= 0x3FFF; // if 1 rom capasity is 16K
+    else
+        addr &= 0x7FFF; // if 2 rom capasity is 32K
+
+    return addr;
+}
+
+static inline u8
 mapper0_cpu_read(Mapper0Data* data, u16 addr) {
 
     if(!address_is_between(addr, MAP0_START, MAP0_END)) {
         return 0;
     }
 
+    u8 window = CDL_WINDOW(addr);
     if(cartridge.numProgramRoms == 1)
         addr &= 0x3FFF; // if 1 rom capasity is 16K
     else
         addr &= 0x7FFF; // if 2 rom capasity is 32K
 
+    data->head.prgCdl[addr] |= CdlData | window;
     return data->head.programMemory[addr];
 }
 
 void
 mapper0_cpu_write(Mapper0Data* data, u16 addr, u8 val) {
 
+    (void)data;
+    (void)val;
     if(!address_is_between(addr, MAP0_START, MAP0_END)) {
         ABORT("invalid address in mapper0 0x%04X", addr);
         return;
     }
 
-    if(cartridge.numProgramRoms == 1)
-        addr &= 0x3FFF; // if 1 rom capasity is 16K
-    else
-        addr &= 0x7FFF; // if 2 rom capasity is 32K
-
-    data->head.programMemory[addr] = val;
+    // NROM has no reqisters and PRG rom is read only
 }
 
-u8
+static inline u8
 mapper0_ppu_read(Mapper0Data* data, u16 addr) {
 
     if(!address_is_between(addr, 0, MAP0_PPU_DATA_SIZE))
         ABORT("invalid address in mapper0 0x%04X", addr);
 
+    data->head.chrCdl[addr] |= data->head.chrCdlAccess;
     return data->head.characterMemory[addr];
 }
 
@@ -97,7 +111,7 @@ mapper0_ppu_write(Mapper0Data* data, u16 addr, u8 val) {
 
     if(!address_is_between(addr, 0, MAP0_PPU_DATA_SIZE)) ABORT("invalid address in mapper0");
 
-    data->head.characterMemory[addr] = val;
+    if(data->head.characterRam) data->head.characterRam[addr] = val;
 }
 
 struct Mapper mapper0 = {
@@ -107,6 +121,7 @@ struct Mapper mapper0 = {
     .ppu_write_cartridge    = (ppu_write_func)mapper0_ppu_write,
     .mapper_init            = (mapper_init_func)mapper0_init,
     .mapper_dispose         = (mapper_dispose_func)mapper0_dispose,
+    .cpu_prg_offset         = (prg_offset_func)mapper0_prg_offset,
 
     .cpu_peak_cartridge     = (peak_func)mapper0_cpu_peak,
     .mapper_disasseble      = (disasseble_func)mapper0_disasseble
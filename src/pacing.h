@@ -0,0 +1,109 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef PACING_H
+#define PACING_H
+
+#include <time.h>
+#include <errno.h>
+#include "defs.h"
+#include "apu.h"
+
+// Frame pacing
+//
+// Main loop sleeps between frames instead of polling the time. With
+// PacingClock it sleeps to absolute deadlines one NTSC frame apart, so timer
+// wakeup latency does not add up over frames. With PacingAudio it sleeps
+// until the audio ring has drained to its target fill, so emulation runs
+// exactly at the rate the sound card plays and the output rate is not
+// adjusted. Audio pacing falls back to clock when no audio device is open
+// and while the debugger has stopped emulation.
+
+// NTSC frame is 89341.5 ppu dots at 21.477272 MHz / 4, 60.0988 Hz
+#define PACING_FRAME_NS         16639264
+// deadlines are moved to now when emulation is this many frames late,
+// after breakpoint or slow frames, instead of running fast to catch up
+#define PACING_MAX_LATE_FRAMES  4
+
+typedef enum PacingMode {
+    PacingClock,
+    PacingAudio,
+} PacingMode;
+
+struct Pacing {
+    PacingMode      mode;
+    struct timespec deadline;
+} pacing;
+
+static inline u64
+pacing_ns(const struct timespec* time) {
+    return (u64)time->tv_sec * 1000000000 + time->tv_nsec;
+}
+
+static void
+pacing_sleep_until(const struct timespec* deadline) {
+    // restarted if a signal wakes it early
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR);
+}
+
+static void
+pacing_init(PacingMode mode) {
+
+    if(mode == PacingAudio && !apu.device) {
+        LOG("no audio device, pacing with clock");
+        mode = PacingClock;
+    }
+    pacing.mode = mode;
+    // audio sets the pace, rate control would fight it
+    apu.fixedRate = mode == PacingAudio;
+
+    clock_gettime(CLOCK_MONOTONIC, &pacing.deadline);
+}
+
+static void
+pacing_wait_clock() {
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    u64 deadline = pacing_ns(&pacing.deadline) + PACING_FRAME_NS;
+    if(pacing_ns(&now) > deadline + PACING_MAX_LATE_FRAMES * PACING_FRAME_NS) {
+        pacing.deadline = now;
+        return;
+    }
+
+    pacing.deadline.tv_sec = deadline / 1000000000;
+    pacing.deadline.tv_nsec = deadline % 1000000000;
+    pacing_sleep_until(&pacing.deadline);
+}
+
+static void
+pacing_wait_audio() {
+
+    // ring fills at start and after pauses without waiting
+    u32 fill = audioring_count(&apu.ring);
+    if(fill <= APU_TARGET_FILL || !apu.playing) return;
+
+    // time the samples above target take to play
+    u64 ns = (u64)(fill - APU_TARGET_FILL) * 1000000000 / apu.sampleRate;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    u64 deadline = pacing_ns(&now) + ns;
+    struct timespec wake = { .tv_sec = deadline / 1000000000, .tv_nsec = deadline % 1000000000 };
+    pacing_sleep_until(&wake);
+}
+
+// called once per main loop iteration, after the frame is shown
+static void
+pacing_wait(u8 ranFrame) {
+
+    if(pacing.mode == PacingAudio && ranFrame) {
+        pacing_wait_audio();
+    } else {
+        pacing_wait_clock();
+    }
+}
+
+#endif /* PACING_H */
@@ -3,6 +3,8 @@
  *********************************************************** */
 
 static u8 ppu_read(u16 addr);
+// apu.h
+static void apu_event();
 
 #ifndef PPU_H
 #define PPU_H
@@ -27,6 +29,9 @@ static u8 ppu_read(u16 addr);
 
 #define PPU_DMA_WRITE_ADDRESS           0x4014
 
+#define PPU_SCANLINE_DOTS               341
+#define PPU_FRAME_DOTS                  (262 * PPU_SCANLINE_DOTS)
+
 #include "cpudata.h"
 
 typedef struct ImageView {
@@ -142,6 +147,17 @@ struct PPU {
     // column
     i16         cycle;
     u8          frameComplete;
+    // frames since reset, with scanline and cycle gives ppu_dot
+    u64         frame;
+
+    // mapper event (MMC3 scanline IRQ) and apu event (frame counter and DMC)
+    // are due when ppu_dot reaches their dot, 0 when nothing is scheduled.
+    // eventDot is the earlier of them and eventCycle the cycle of eventDot,
+    // so ppu_clock compares only one dot
+    u64         mapperEventDot;
+    u64         apuEventDot;
+    u64         eventDot;
+    i16         eventCycle;
 
     u8          statusReq;
     u8          maskReq;
@@ -553,6 +569,69 @@ increment_coarseX() {
     }
 }
 
+// dots since reset, the dot ppu_clock runs next
+static inline u64
+ppu_dot() {
+    return ppu.frame * PPU_FRAME_DOTS + (ppu.scanline + 1) * PPU_SCANLINE_DOTS + ppu.cycle;
+}
+
+static void
+ppu_update_event() {
+
+    u64 dot = ppu.mapperEventDot;
+    if(ppu.apuEventDot && (!dot || ppu.apuEventDot < dot)) dot = ppu.apuEventDot;
+    ppu.eventDot = dot;
+    ppu.eventCycle = dot % PPU_SCANLINE_DOTS;
+}
+
+// mapper gets ppu_event call when ppu_dot reaches dot, 0 cancels
+static void
+ppu_schedule_event(u64 dot) {
+    ppu.mapperEventDot = dot;
+    ppu_update_event();
+}
+
+// apu_event is called when ppu_dot reaches dot, 0 cancels
+static void
+ppu_schedule_apu_event(u64 dot) {
+    // ppu_clock skips dot 1 of scanline 0, event there runs on the next dot
+    if(dot % PPU_FRAME_DOTS == PPU_SCANLINE_DOTS + 1) dot++;
+    ppu.apuEventDot = dot;
+    ppu_update_event();
+}
+
+// handlers may schedule again, so slots are cleared before they run
+static void
+ppu_run_events() {
+
+    u64 dot = ppu.eventDot;
+    u8 mapperDue = ppu.mapperEventDot == dot;
+    u8 apuDue = ppu.apuEventDot == dot;
+    if(mapperDue) ppu.mapperEventDot = 0;
+    if(apuDue) ppu.apuEventDot = 0;
+    ppu_update_event();
+
+    if(mapperDue) cartridge_ppu_event();
+    if(apuDue) apu_event();
+}
+
+// Cycle on rendered scanlines where pattern table address line A12 rises
+// after being low long enough for MMC3 to clock its scanline counter, -1 when
+// it does not rise once per scanline. Unused 8x16 sprite slots fetch tile $FF
+// from $1000, so 8x16 sprites count as sprites at $1000
+static i16
+ppu_a12_rise_cycle() {
+
+    if(!(ppu.maskReq & (ShowBackground | ShowSprites))) return -1;
+
+    u8 backgroundHigh = (ppu.controllerReq & BackgroundTableAddress) != 0;
+    u8 spritesHigh = (ppu.controllerReq & (SpritePatterntableAddress | SpriteSize)) != 0;
+
+    if(!backgroundHigh && spritesHigh) return 260;  // sprite fetches
+    if(backgroundHigh && !spritesHigh) return 324;  // next scanline tile fetches
+    return -1;
+}
+
 static void
 ppu_clock() {
 
@@ -811,8 +890,13 @@ ppu_clock() {
         {
             ppu.scanline = -1;
             ppu.frameComplete = 1;
+            ppu.frame++;
         }
     }
+
+    if(ppu.cycle == ppu.eventCycle && ppu_dot() == ppu.eventDot) {
+        ppu_run_events();
+    }
 }
 
 static void
@@ -832,13 +916,19 @@ ppu_cpu_write(u16 addr, u8 data) {
     switch(addr) {
         case 0x0: //PPUCTRL
             {
+                u8 changed = ppu.controllerReq != data;
                 ppu.controllerReq = data;
                 ppu.loopyT.nametableSelect = ppu.controllerReq & 0x3;
                 // TODO should generate NMI if in vertical blank?
+
+                // pattern tables or sprite size might move A12 rises
+                if(changed) cartridge_ppu_config();
             } break;
         case 0x1: //PPUMASK
             {
+                u8 changed = ppu.maskReq != data;
                 ppu.maskReq = data;
+                if(changed) cartridge_ppu_config();
             } break;
         case 0x2: //PPUSTATUS
             {
@@ -932,7 +1022,9 @@ ppu_cpu_read(u16 addr) {
                           // Thus, after setting the VRAM address,
                           // one should first read this register and discard the result.
                           ret = ppu.internalDataBuffer;
+                          mapper.data.head.chrCdlAccess = CdlRead;
                           ppu.internalDataBuffer = ppu_read(ppu.loopyV.reqister);
+                          mapper.data.head.chrCdlAccess = CdlDrawn;
                       }
 
                       ppu.loopyV.reqister += ppu.controllerReq & VramAddressIncrement ? 32 : 1;
@@ -948,7 +1040,10 @@ ppu_cpu_read(u16 addr) {
 
 static void
 ppu_render_patterntable(u8 index, u32 paletteIndex) { // there is 2 pattern tables so this is 0 or 1
-#ifndef LOGFILE
+
+    // visualisation is not logged as rendered
+    mapper.data.head.chrCdlAccess = 0;
+
     for(u16 tileY = 0; tileY < NUM_TILES; tileY++) { // FOR TILE Y
 
         for(u16 tileX = 0; tileX < NUM_TILES; tileX++) { // FOR TILE X
@@ -986,7 +1081,8 @@ ppu_render_patterntable(u8 index, u32 paletteIndex) { // there is 2 pattern tabl
             }
         }
     }
-#endif
+
+    mapper.data.head.chrCdlAccess = CdlDrawn;
 }
 
 static void
@@ -996,6 +1092,9 @@ ppu_render_oam() { // there is 2 pattern tables so this is 0 or 1
     memset(ppu.OAMvisualisation.data, 0,
             ppu.OAMvisualisation.w * ppu.OAMvisualisation.h * sizeof(Color));
 
+    // visualisation is not logged as rendered
+    mapper.data.head.chrCdlAccess = 0;
+
     OAMData* data = (OAMData*)ppu.oam.primary; // TODO fix pointer cast
     for(u16 tileY = 0; tileY < 8; tileY++) { // FOR TILE Y
 
@@ -1043,6 +1142,8 @@ ppu_render_oam() { // there is 2 pattern tables so this is 0 or 1
             }
         }
     }
+
+    mapper.data.head.chrCdlAccess = CdlDrawn;
 #endif
 }
 
@@ -1208,6 +1309,16 @@ ppu_init() {
     GLCHECK(glDepthMask(GL_FALSE));
 }
 
+// ppu without any rendering resources, only the screen buffer ppu_clock draws to
+static void
+ppu_init_headless() {
+
+    memset(&ppu, 0, sizeof(struct PPU));
+    ppu.screen = (ImageView) {
+        .w = TEX_WIDTH, .h = TEX_HEIGHT, .data = calloc(TEX_WIDTH * TEX_HEIGHT, sizeof(Color))
+    };
+}
+
 static void
 ppu_render() {
 
@@ -22,6 +22,9 @@
 static void _LOG(const char* file,const u32 row,FILE* stream,char* format,...);
 static void _LOG_COLOR (u32 color,const char* file,const u32 row,FILE* stream,char* format,...);
 
+// called before exiting on failed assert or abort (trace dump)
+static void (*abortCallback)() = NULL;
+
 #if defined(WINDOWS_PLATFORM)
 #include <windows.h>
 
@@ -151,6 +154,7 @@ static void _ASSERT_MESSAGE(u8 condition,const char* condStr,const char* file,co
             SetConsoleTextAttribute(consoleHandle, saved_attributes);
         }
 #endif
+        if(abortCallback) abortCallback();
         _Exit(1);
     }
 }
@@ -193,6 +197,7 @@ static void _ABORT(const char* file,const u32 row,char* format,...) {
         SetConsoleTextAttribute(consoleHandle, saved_attributes);
     }
 #endif
+    if(abortCallback) abortCallback();
     getchar();
     _Exit(1);
 }
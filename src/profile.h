@@ -0,0 +1,387 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "defs.h"
+#include "printutils.h"
+#include "cpudata.h"
+#include "cartridge.h"
+
+// Execution profiler
+//
+// Counts executed instructions and cycles for every PRG byte (so same pc in
+// different banks is kept apart) and for every address below PRG rom (code in
+// ram or PRG ram). JSR targets, interrupt vectors and labels of ca65 debug
+// file mark routine starts, on exit counts are summed to routines and report
+// of hottest routines, instructions and opcodes is written to PROFILE_REPORT_FILE.
+
+#define PROFILE_REPORT_FILE     "profile.txt"
+#define PROFILE_TOP_ROUTINES    40
+#define PROFILE_TOP_PCS         40
+#define PROFILE_LOW_SIZE        PRG_WINDOW_START // code below PRG rom, indexed by address
+#define PROFILE_NAME_LEN        64
+
+typedef struct ProfileCounter {
+    u64 instructions;
+    u64 cycles;
+} ProfileCounter;
+
+typedef struct ProfileLabel {
+    char    name[PROFILE_NAME_LEN];
+    u16     addr;
+    u32     prgOffset; // numeric_max_u32 if segment is unknown
+} ProfileLabel;
+
+struct Profile {
+    u8              enabled;
+
+    // per PRG byte, pc is the address the byte was last executed at
+    ProfileCounter* prg;
+    u16*            prgPc;
+    u8*             prgRoutineStart;
+    u32             prgLen;
+
+    ProfileCounter  low[PROFILE_LOW_SIZE];
+    u8              lowRoutineStart[PROFILE_LOW_SIZE];
+
+    ProfileCounter  opcodes[256];
+
+    ProfileLabel*   labels;
+    u32             numLabels;
+} profile;
+
+// PRG offset of currently mapped cpu address or numeric_max_u32
+static inline u32
+profile_prg_offset(u16 addr) {
+    if(addr < PRG_WINDOW_START) return numeric_max_u32;
+    DecodedInstruction* window = cartridge_decoded_window(addr);
+    if(!window) return numeric_max_u32;
+    return (u32)(window - mapper.data.head.decoded) + (addr & (PRG_WINDOW_SIZE - 1));
+}
+
+static void
+profile_mark_routine(u16 addr) {
+    u32 offset = profile_prg_offset(addr);
+    if(offset != numeric_max_u32) {
+        profile.prgRoutineStart[offset] = 1;
+    } else if(addr < PROFILE_LOW_SIZE) {
+        profile.lowRoutineStart[addr] = 1;
+    }
+}
+
+// called after instruction is executed, cpu.cycles holds its cycles
+static inline void
+profile_record(u16 pc, DecodedInstruction* instruct) {
+
+    ProfileCounter* counter;
+    u32 offset = profile_prg_offset(pc);
+    if(offset != numeric_max_u32) {
+        counter = &profile.prg[offset];
+        profile.prgPc[offset] = pc;
+    } else {
+        counter = &profile.low[pc & (PROFILE_LOW_SIZE - 1)];
+    }
+    counter->instructions += 1;
+    counter->cycles += cpu.cycles;
+
+    profile.opcodes[instruct->opcode].instructions += 1;
+    profile.opcodes[instruct->opcode].cycles += cpu.cycles;
+
+    if(instruct->instructionCode == JSR) {
+        profile_mark_routine(instruct->operand);
+    }
+}
+
+// value of key=value field in ca65 debug file line, strings without quotes
+static u8
+profile_dbg_field(const char* line, const char* key, char* out, u32 outLen) {
+
+    u32 keyLen = strlen(key);
+    const char* field = line;
+    while((field = strstr(field, key)) != NULL) {
+        // key has to start the field
+        if(field == line || field[-1] == ',' || field[-1] == '\t') break;
+        field += keyLen;
+    }
+    if(!field) return 0;
+
+    field += keyLen;
+    u8 quoted = *field == '"';
+    if(quoted) field++;
+
+    u32 i = 0;
+    while(field[i] && i + 1 < outLen &&
+            (quoted ? field[i] != '"' : (field[i] != ',' && field[i] != '\n' && field[i] != '\r'))) {
+        out[i] = field[i];
+        i++;
+    }
+    out[i] = '\0';
+    return 1;
+}
+
+// reads labels from ca65/ld65 debug file (ld65 --dbgfile)
+static void
+profile_load_dbg(const char* path) {
+
+    FILE* file = fopen(path, "r");
+    if(!file) {
+        LOG("failed to open debug file %s", path);
+        return;
+    }
+
+    // segment id -> cpu start address and offset in rom file
+    typedef struct { u32 start; u32 fileOffset; u8 valid; } DbgSegment;
+    DbgSegment segments[256] = { 0 };
+
+    char line[1024];
+    char value[PROFILE_NAME_LEN];
+    u32 capacity = 0;
+
+    while(fgets(line, sizeof(line), file)) {
+
+        if(strncmp(line, "seg\t", 4) == 0) {
+            if(!profile_dbg_field(line, "id=", value, sizeof(value))) continue;
+            u32 id = strtoul(value, NULL, 0);
+            if(id >= SIZEOF_ARRAY(segments)) continue;
+            if(!profile_dbg_field(line, "start=", value, sizeof(value))) continue;
+            segments[id].start = strtoul(value, NULL, 0);
+            if(profile_dbg_field(line, "ooffs=", value, sizeof(value))) {
+                segments[id].fileOffset = strtoul(value, NULL, 0);
+                segments[id].valid = 1;
+            }
+        } else if(strncmp(line, "sym\t", 4) == 0) {
+            if(!profile_dbg_field(line, "type=", value, sizeof(value)) || strcmp(value, "lab") != 0) continue;
+            if(!profile_dbg_field(line, "val=", value, sizeof(value))) continue;
+
+            if(profile.numLabels == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                profile.labels = realloc(profile.labels, capacity * sizeof(ProfileLabel));
+                ASSERT_MESSAGE(profile.labels, "failed to allocate labels");
+            }
+
+            ProfileLabel* label = &profile.labels[profile.numLabels++];
+            label->addr = strtoul(value, NULL, 0);
+            label->prgOffset = numeric_max_u32;
+            profile_dbg_field(line, "name=", label->name, sizeof(label->name));
+
+            if(profile_dbg_field(line, "seg=", value, sizeof(value))) {
+                u32 seg = strtoul(value, NULL, 0);
+                // rom file starts with 16 byte ines header
+                if(seg < SIZEOF_ARRAY(segments) && segments[seg].valid &&
+                        segments[seg].fileOffset >= sizeof(INESHeader) && label->addr >= segments[seg].start) {
+                    label->prgOffset = segments[seg].fileOffset - sizeof(INESHeader) +
+                        (label->addr - segments[seg].start);
+                }
+            }
+        }
+    }
+    fclose(file);
+    LOG("loaded %d labels from %s", profile.numLabels, path);
+}
+
+// has to be called after cartridge is loaded
+static void
+profile_enable(const char* dbgPath) {
+
+    profile.prgLen = mapper.data.head.programMemoryLen;
+    profile.prg = calloc(profile.prgLen, sizeof(ProfileCounter));
+    profile.prgPc = calloc(profile.prgLen, sizeof(u16));
+    profile.prgRoutineStart = calloc(profile.prgLen, sizeof(u8));
+    ASSERT_MESSAGE(profile.prg && profile.prgPc && profile.prgRoutineStart,
+            "failed to allocate profiler");
+
+    if(dbgPath) profile_load_dbg(dbgPath);
+
+    for(u32 i = 0; i < profile.numLabels; i++) {
+        ProfileLabel* label = &profile.labels[i];
+        if(label->prgOffset < profile.prgLen) {
+            profile.prgRoutineStart[label->prgOffset] = 1;
+        } else if(label->addr < PROFILE_LOW_SIZE) {
+            profile.lowRoutineStart[label->addr] = 1;
+        }
+    }
+
+    profile.enabled = 1;
+}
+
+static const char*
+profile_label_name(u32 prgOffset, u16 addr) {
+
+    // exact bank match first, then any label with same address
+    for(u32 i = 0; i < profile.numLabels; i++) {
+        if(profile.labels[i].prgOffset == prgOffset && prgOffset != numeric_max_u32) {
+            return profile.labels[i].name;
+        }
+    }
+    for(u32 i = 0; i < profile.numLabels; i++) {
+        if(profile.labels[i].addr == addr && profile.labels[i].prgOffset == numeric_max_u32) {
+            return profile.labels[i].name;
+        }
+    }
+    return NULL;
+}
+
+typedef struct ProfileEntry {
+    ProfileCounter  counter;
+    u32             prgOffset; // numeric_max_u32 for code below PRG rom
+    u16             addr;
+} ProfileEntry;
+
+static int
+profile_entry_compare(const void* a, const void* b) {
+    u64 first = ((const ProfileEntry*)a)->counter.cycles;
+    u64 second = ((const ProfileEntry*)b)->counter.cycles;
+    return first < second ? 1 : first > second ? -1 : 0;
+}
+
+static void
+profile_entry_location(ProfileEntry* entry, char* buffer) {
+    if(entry->prgOffset == numeric_max_u32) {
+        sprintf(buffer, " --:%04X", entry->addr);
+    } else {
+        sprintf(buffer, "%3d:%04X", entry->prgOffset / PROG_ROM_SINGLE_SIZE, entry->addr);
+    }
+}
+
+// sums counters to routines, region from routine start to the next one
+static u32
+profile_sum_routines(ProfileCounter* counters, u16* pcs, u8* starts, u32 len,
+        u8 isPrg, ProfileEntry* out) {
+
+    u32 count = 0;
+    i64 current = -1;
+    for(u32 i = 0; i < len; i++) {
+        // routines dont continue over 16K bank boundary
+        if(starts[i] || (isPrg && i % PROG_ROM_SINGLE_SIZE == 0) || current < 0) {
+            out[count] = (ProfileEntry){
+                .prgOffset = isPrg ? i : numeric_max_u32, .addr = isPrg ? 0 : i };
+            current = count++;
+        }
+        if(counters[i].instructions == 0) continue;
+
+        ProfileEntry* routine = &out[current];
+        if(routine->counter.instructions == 0 && isPrg) {
+            // address of the routine start as executed, estimated from first counted byte
+            routine->addr = pcs[i] - (i - routine->prgOffset);
+        }
+        routine->counter.instructions += counters[i].instructions;
+        routine->counter.cycles += counters[i].cycles;
+    }
+    return count;
+}
+
+static void
+profile_report(const char* path) {
+
+    if(!profile.enabled) return;
+
+    FILE* file = fopen(path, "w");
+    if(!file) {
+        LOG("failed to open profile report %s", path);
+        return;
+    }
+
+    // interrupt vectors are entry points too
+    profile_mark_routine(bus_read16(RESET_PC_LOCATION));
+    profile_mark_routine(bus_read16(NMI_PC_LOCATION));
+    profile_mark_routine(bus_read16(IRQ_OR_BRK_PC_LOCATION));
+
+    u64 totalInstructions = 0, totalCycles = 0;
+    for(u32 i = 0; i < 256; i++) {
+        totalInstructions += profile.opcodes[i].instructions;
+        totalCycles += profile.opcodes[i].cycles;
+    }
+    double cyclePercent = totalCycles ? 100.0 / totalCycles : 0;
+
+    fprintf(file, "%lu instructions, %lu cycles\n\n", totalInstructions, totalCycles);
+
+    // routines
+    ProfileEntry* entries = calloc(profile.prgLen + PROFILE_LOW_SIZE, sizeof(ProfileEntry));
+    ASSERT_MESSAGE(entries, "failed to allocate profile report");
+
+    u32 numEntries = profile_sum_routines(profile.prg, profile.prgPc, profile.prgRoutineStart,
+            profile.prgLen, 1, entries);
+    numEntries += profile_sum_routines(profile.low, NULL, profile.lowRoutineStart,
+            PROFILE_LOW_SIZE, 0, entries + numEntries);
+    qsort(entries, numEntries, sizeof(ProfileEntry), profile_entry_compare);
+
+    char location[16];
+    fprintf(file, "hottest routines\n");
+    fprintf(file, "%12s %7s %12s  %-8s  %s\n", "cycles", "%", "instructions", "bank:pc", "routine");
+    for(u32 i = 0; i < numEntries && i < PROFILE_TOP_ROUTINES && entries[i].counter.cycles; i++) {
+        ProfileEntry* entry = &entries[i];
+        const char* name = profile_label_name(entry->prgOffset, entry->addr);
+        char autoName[16];
+        if(!name) {
+            sprintf(autoName, "sub_%04X", entry->addr);
+            name = autoName;
+        }
+        profile_entry_location(entry, location);
+        fprintf(file, "%12lu %6.2f%% %12lu  %s  %s\n", entry->counter.cycles,
+                entry->counter.cycles * cyclePercent, entry->counter.instructions, location, name);
+    }
+
+    // single instructions
+    numEntries = 0;
+    for(u32 i = 0; i < profile.prgLen; i++) {
+        if(profile.prg[i].instructions) {
+            entries[numEntries++] = (ProfileEntry){
+                .counter = profile.prg[i], .prgOffset = i, .addr = profile.prgPc[i] };
+        }
+    }
+    for(u32 i = 0; i < PROFILE_LOW_SIZE; i++) {
+        if(profile.low[i].instructions) {
+            entries[numEntries++] = (ProfileEntry){
+                .counter = profile.low[i], .prgOffset = numeric_max_u32, .addr = i };
+        }
+    }
+    qsort(entries, numEntries, sizeof(ProfileEntry), profile_entry_compare);
+
+    fprintf(file, "\nhottest instructions\n");
+    fprintf(file, "%12s %7s %12s  %-8s  %s\n", "cycles", "%", "count", "bank:pc", "instruction");
+    for(u32 i = 0; i < numEntries && i < PROFILE_TOP_PCS; i++) {
+        ProfileEntry* entry = &entries[i];
+        u8 opcode = entry->prgOffset == numeric_max_u32 ?
+            bus_peak8(entry->addr, NULL) : mapper.data.head.programMemory[entry->prgOffset];
+        profile_entry_location(entry, location);
+        fprintf(file, "%12lu %6.2f%% %12lu  %s  %s\n", entry->counter.cycles,
+                entry->counter.cycles * cyclePercent, entry->counter.instructions, location,
+                cpuInstructionStrings[opcode]);
+    }
+
+    // opcodes
+    numEntries = 0;
+    for(u32 i = 0; i < 256; i++) {
+        if(profile.opcodes[i].instructions) {
+            entries[numEntries++] = (ProfileEntry){ .counter = profile.opcodes[i], .addr = i };
+        }
+    }
+    qsort(entries, numEntries, sizeof(ProfileEntry), profile_entry_compare);
+
+    fprintf(file, "\nopcodes\n");
+    fprintf(file, "%12s %7s %12s  %-6s  %s\n", "cycles", "%", "count", "opcode", "instruction");
+    for(u32 i = 0; i < numEntries; i++) {
+        ProfileEntry* entry = &entries[i];
+        fprintf(file, "%12lu %6.2f%% %12lu  0x%02X    %s\n", entry->counter.cycles,
+                entry->counter.cycles * cyclePercent, entry->counter.instructions, entry->addr,
+                cpuInstructionStrings[entry->addr]);
+    }
+
+    free(entries);
+    fclose(file);
+    LOG("profile written to %s", path);
+}
+
+static void
+profile_dispose() {
+    free(profile.prg);
+    free(profile.prgPc);
+    free(profile.prgRoutineStart);
+    free(profile.labels);
+    profile.enabled = 0;
+}
+
+#endif /* PROFILE_H */
@@ -0,0 +1,76 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef ROMDB_H
+#define ROMDB_H
+
+#include "defs.h"
+#include "printutils.h"
+
+// Rom database
+//
+// Known good mapper and mirroring for roms, keyed by CRC32 of PRG and CHR rom
+// (same as cartridge.crc32, NesCartDB and No-Intro use it too) so roms with
+// wrong iNES headers load anyway. Table is a constant built at compile time
+// from ROMDB_LIST and searched with binary search, so lookup needs no file io.
+//
+// Entries have to be sorted by CRC32 (checked on first lookup) and taken from
+// verified dumps, do not add guessed values.
+
+// mirroring column value that keeps the header mirroring
+#define ROMDB_MIRROR_HEADER     0xFF
+
+typedef struct RomDbEntry {
+    u32 crc32;
+    u16 mapperID;
+    u8  mirroring;      // MirrorType or ROMDB_MIRROR_HEADER
+} RomDbEntry;
+
+//  ENTRY(crc32, mapper, mirroring)
+#define ROMDB_LIST(ENTRY)                                               \
+    /* Super Mario Bros. (World) */                                     \
+    ENTRY(0x3337EC46, 0, VERTICAL)
+
+#define ROMDB_ENTRY(CRC, MAPPER, MIRRORING) \
+    { .crc32 = CRC, .mapperID = MAPPER, .mirroring = MIRRORING },
+
+static const RomDbEntry romDatabase[] = {
+    ROMDB_LIST(ROMDB_ENTRY)
+};
+
+#undef ROMDB_ENTRY
+
+// binary search from table sorted by crc32
+static const RomDbEntry*
+romdb_search(const RomDbEntry* table, u32 count, u32 crc32) {
+
+    static u8 checked = 0;
+    if(!checked) {
+        for(u32 i = 1; i < count; i++) {
+            ASSERT_MESSAGE(table[i - 1].crc32 < table[i].crc32,
+                    "rom database is not sorted at entry %u", i);
+        }
+        checked = 1;
+    }
+
+    u32 low = 0, high = count;
+    while(low < high) {
+        u32 mid = low + (high - low) / 2;
+        if(table[mid].crc32 < crc32) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if(low < count && table[low].crc32 == crc32) return &table[low];
+    return NULL;
+}
+
+static const RomDbEntry*
+romdb_find(u32 crc32) {
+    return romdb_search(romDatabase, SIZEOF_ARRAY(romDatabase), crc32);
+}
+
+#endif /* ROMDB_H */
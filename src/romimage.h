@@ -0,0 +1,148 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef ROMIMAGE_H
+#define ROMIMAGE_H
+
+#include <sys/stat.h>
+#include "defs.h"
+#include "printutils.h"
+#include "fileload.h"
+
+// Immutable rom images
+//
+// Rom file is mapped read only once and shared by every cartridge loaded from
+// the same file, loading it again only takes a reference. PRG and CHR rom are
+// never written (writes to rom space only go to mapper reqisters) so all
+// per machine state lives in the mapper data.
+
+#define PROG_ROM_SINGLE_SIZE    0x4000 // 16 K
+#define CHAR_ROM_SINGLE_SIZE    0x2000 // 8 K
+#define TRAINER_SIZE            512
+
+// https://wiki.nesdev.com/w/index.php/INES
+// https://formats.kaitai.io/ines/index.html
+typedef struct INESHeader {
+    u32     magic;
+    u8      programRomCount;
+    u8      charaterRomCount;
+    u8      flag6;
+    u8      flag7;
+    u8      programRamLen;
+    u8      flags9;  // Rarely used
+    u8      flags10; // Rarely used
+    char    reserved[5];
+} INESHeader;
+
+STATIC_ASSERT(sizeof(INESHeader) == 16, header_size_wrong);
+
+// INES fomrat contains
+//
+// Header (16 bytes)
+// Trainer, if present (0 or 512 bytes)
+// PRG ROM data (16384 * x bytes)
+// CHR ROM data, if present (8192 * y bytes)
+// PlayChoice INST-ROM, if present (0 or 8192 bytes)
+// PlayChoice PROM, if present (16 bytes Data, 16 bytes CounterOut)
+//                  (this is often missing, see PC10 ROM-Images for details)
+
+typedef struct RomImage {
+    INESHeader          header;
+    const u8*           programRom;
+    u32                 programRomLen;
+    const u8*           characterRom;
+    u32                 characterRomLen;
+    u32                 crc32;      // of PRG and CHR rom, without header
+
+    // mapped file and what identifies it
+    u8*                 file;
+    size_t              fileSize;
+    dev_t               device;
+    ino_t               inode;
+
+    u32                 refCount;
+    struct RomImage*    next;
+} RomImage;
+
+// every loaded image
+static RomImage* romImages = NULL;
+
+// returns image of rom file, NULL if it can not be loaded
+static RomImage*
+romimage_acquire(const char* path) {
+
+    struct stat st;
+    if(stat(path, &st) != 0) {
+        LOG("failed to open rom %s", path);
+        return NULL;
+    }
+
+    for(RomImage* image = romImages; image; image = image->next) {
+        if(image->device == st.st_dev && image->inode == st.st_ino &&
+                image->fileSize == (size_t)st.st_size) {
+            image->refCount++;
+            return image;
+        }
+    }
+
+    size_t size;
+    u8* file = map_binary_file(path, &size);
+    if(!file || size < sizeof(INESHeader)) {
+        LOG("failed to map rom %s", path);
+        unmap_file(file, size);
+        return NULL;
+    }
+
+    RomImage* image = calloc(1, sizeof(RomImage));
+    ASSERT_MESSAGE(image, "failed to allocate rom image");
+    memcpy(&image->header, file, sizeof(INESHeader));
+
+    const u8* data = file + sizeof(INESHeader);
+    // next 512 bytes is trainer //TODO
+    if(image->header.flag6 & 0x04) {
+        data += TRAINER_SIZE;
+    }
+
+    image->programRom = data;
+    image->programRomLen = image->header.programRomCount * PROG_ROM_SINGLE_SIZE;
+    data += image->programRomLen;
+    image->characterRom = data;
+    image->characterRomLen = image->header.charaterRomCount * CHAR_ROM_SINGLE_SIZE;
+    data += image->characterRomLen;
+
+    if((size_t)(data - file) > size) {
+        LOG("rom file %s is truncated", path);
+        unmap_file(file, size);
+        free(image);
+        return NULL;
+    }
+
+    image->crc32 = crc32_update(0, image->programRom, image->programRomLen + image->characterRomLen);
+    image->file = file;
+    image->fileSize = size;
+    image->device = st.st_dev;
+    image->inode = st.st_ino;
+    image->refCount = 1;
+    image->next = romImages;
+    romImages = image;
+
+    return image;
+}
+
+static void
+romimage_release(RomImage* image) {
+
+    if(!image || --image->refCount > 0) return;
+
+    for(RomImage** it = &romImages; *it; it = &(*it)->next) {
+        if(*it == image) {
+            *it = image->next;
+            break;
+        }
+    }
+    unmap_file(image->file, image->fileSize);
+    free(image);
+}
+
+#endif /* ROMIMAGE_H */
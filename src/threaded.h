@@ -0,0 +1,203 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef THREADED_H
+#define THREADED_H
+
+#include "defs.h"
+#include "cpu.h"
+#include "jit.h"
+
+// Threaded code interpreter for code running from PRG rom
+//
+// Each PRG window is translated the first time it is mapped into cells of
+// {handler, operand}, one per PRG byte so any byte can be jumped to. Handlers
+// are labels in threaded_run and are dispatched with computed goto, so there
+// is no opcode fetch, table lookup or address mode decode in the hot loop and
+// no executable memory is needed. Cells start with handler that marks the
+// instruction to code/data log and then replaces itself with opcode handler.
+//
+// Same rules as with the jit (jit.h): only instructions that can not touch I/O
+// are run threaded and the run stops before ppu can raise NMI or event IRQ.
+
+typedef struct ThreadedCell {
+    void*   handler;    // label in threaded_run
+    u16     operand;
+    u8      cycles;     // base cycles, 0 for cells that stop the run
+} ThreadedCell;
+
+struct Threaded {
+    // one cell per PRG byte
+    ThreadedCell*   cells;
+    // 1 for every PRG window (8K) that is translated
+    u8*             translated;
+    u32             numWindows;
+
+    // handler labels for each opcode, for cells that stop the run and for
+    // cells not run yet
+    void*           handlers[256];
+    void*           stop;
+    void*           mark;
+
+    u64             runs;
+    u64             instructionsRun;
+} threaded;
+
+static u8 threaded_execute(u8 getHandlers);
+
+static void
+threaded_init() {
+
+    // run once to get the label addresses
+    threaded_execute(1);
+}
+
+static void
+threaded_dispose() {
+
+    if(threaded.runs) {
+        LOG("threaded code ran %lu times, %lu instructions", threaded.runs, threaded.instructionsRun);
+    }
+    free(threaded.cells);
+    free(threaded.translated);
+}
+
+// translates PRG window starting at PRG memory offset
+static void
+threaded_translate_window(u32 windowOffset) {
+
+    MapperHeader* head = &mapper.data.head;
+    const u8* prg = &head->programMemory[windowOffset];
+
+    for(u32 i = 0; i < PRG_WINDOW_SIZE; i++) {
+
+        Instruction instruction = instructionTable[prg[i]];
+        DecodedInstruction instruct = {
+            .operand = 0, .opcode = prg[i], .instructionCode = instruction.instructionCode,
+            .addressMode = instruction.addressMode, .cycles = instruction.cycles,
+            .length = 1 + addressModeOperandBytes[instruction.addressMode]
+        };
+
+        ThreadedCell* cell = &threaded.cells[windowOffset + i];
+        *cell = (ThreadedCell){ .handler = threaded.stop, .operand = 0, .cycles = 0 };
+
+        // operands continuing in next window might be from other bank
+        if(i + instruct.length > PRG_WINDOW_SIZE) continue;
+
+        if(instruct.length == 2) {
+            instruct.operand = prg[i + 1];
+        } else if(instruct.length == 3) {
+            instruct.operand = prg[i + 1] | (prg[i + 2] << 8);
+        }
+
+        if(!jit_instruction_eligible(&instruct)) continue;
+
+        *cell = (ThreadedCell) {
+            .handler = threaded.mark,
+            .operand = instruct.operand,
+            .cycles = instruct.cycles
+        };
+    }
+
+    threaded.translated[windowOffset / PRG_WINDOW_SIZE] = 1;
+}
+
+// Runs instructions from the window pc is in until some cell stops the run,
+// pc leaves the window or cycle budget is used. Returns 0 if nothing was run
+static u8
+threaded_execute(u8 getHandlers) {
+
+#define THREADED_LABEL_ENTRY(OPCODE) [OPCODE] = &&op_##OPCODE,
+    static void* const labels[256] = { OPCODE_LIST(THREADED_LABEL_ENTRY) };
+
+    if(getHandlers) {
+        memcpy(threaded.handlers, labels, sizeof(labels));
+        threaded.stop = &&stop;
+        threaded.mark = &&mark;
+        return 0;
+    }
+
+    MapperHeader* head = &mapper.data.head;
+    DecodedInstruction* window = cartridge_decoded_window(cpu.pc);
+    if(!window) return 0;
+
+    u32 windowOffset = (u32)(window - head->decoded);
+    if(!threaded.translated[windowOffset / PRG_WINDOW_SIZE]) {
+        threaded_translate_window(windowOffset);
+    }
+
+    ThreadedCell* cells = &threaded.cells[windowOffset];
+    ThreadedCell* cell;
+    u16 windowStart = cpu.pc & ~(PRG_WINDOW_SIZE - 1);
+    u32 budget = jit_cycle_budget();
+    u32 count = 0;
+
+    cpu.cycles = 0;
+
+#define THREADED_DISPATCH do {                                              \
+    if((cpu.pc & ~(PRG_WINDOW_SIZE - 1)) != windowStart) goto done;         \
+    cell = &cells[cpu.pc & (PRG_WINDOW_SIZE - 1)];                          \
+    if(cpu.cycles + cell->cycles + JIT_MAX_EXTRA_CYCLES > budget) goto done;\
+    goto *cell->handler;                                                    \
+} while(0)
+
+#define THREADED_OP(OPCODE)                                                 \
+op_##OPCODE: {                                                              \
+    DecodedInstruction instruct = {                                         \
+        .operand = cell->operand, .opcode = OPCODE,                         \
+        .instructionCode = instructionTable[OPCODE].instructionCode,        \
+        .addressMode = instructionTable[OPCODE].addressMode,                \
+        .cycles = instructionTable[OPCODE].cycles,                          \
+        .length = 1 + addressModeOperandBytes[instructionTable[OPCODE].addressMode] \
+    };                                                                      \
+    cpu.pc += instruct.length;                                              \
+    cpu.cycles += instruct.cycles;                                          \
+    cpu_execute(instruct, 0);                                                  \
+    count++;                                                                \
+    THREADED_DISPATCH;                                                      \
+}
+
+    THREADED_DISPATCH;
+
+    OPCODE_LIST(THREADED_OP)
+
+mark: {
+    u32 offset = windowOffset + (cpu.pc & (PRG_WINDOW_SIZE - 1));
+    u8 opcode = head->programMemory[offset];
+    u8 length = 1 + addressModeOperandBytes[instructionTable[opcode].addressMode];
+    for(u32 i = 0; i < length; i++) {
+        head->prgCdl[offset + i] |= CdlCode | CDL_WINDOW(cpu.pc);
+    }
+    cell->handler = threaded.handlers[opcode];
+    goto *cell->handler;
+}
+
+stop:
+done:
+    threaded.runs += count > 0;
+    threaded.instructionsRun += count;
+    cpu.instructionCount += count;
+    return count > 0;
+
+#undef THREADED_OP
+#undef THREADED_DISPATCH
+}
+
+static u8
+threaded_run() {
+
+    if(cpu.pc < PRG_WINDOW_START) return 0;
+
+    MapperHeader* head = &mapper.data.head;
+    if(!threaded.cells) {
+        threaded.numWindows = head->programMemoryLen / PRG_WINDOW_SIZE;
+        threaded.cells = calloc(head->programMemoryLen, sizeof(ThreadedCell));
+        threaded.translated = calloc(threaded.numWindows, sizeof(u8));
+        ASSERT_MESSAGE(threaded.cells && threaded.translated, "failed to allocate threaded code");
+    }
+
+    return threaded_execute(0);
+}
+
+#endif /* THREADED_H */
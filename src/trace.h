@@ -0,0 +1,216 @@
+/************************************************************
+ * Check license.txt in project root for license information *
+ *********************************************************** */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "defs.h"
+#include "printutils.h"
+#include "cpudata.h"
+#include "mapperdata.h"
+#include "ppu.h"
+
+// Binary cpu trace
+//
+// When enabled every executed instruction is stored as packed record to a
+// fixed size ring, so hours long runs can be traced and only the last records
+// are written out. Ring is dumped to TRACE_DUMP_FILE on abort or from the
+// debugger, --trace-decode turns dump to nestest style text.
+
+#define TRACE_DEFAULT_RECORDS   (1 << 20)
+#define TRACE_MAGIC             "NESTRACE"
+#define TRACE_VERSION           1
+#define TRACE_DUMP_FILE         "trace.bin"
+
+typedef struct TraceRecord {
+    u64 cycle;          // cpu cycle instruction started at
+    u16 pc;
+    i16 scanline;
+    i16 dot;
+    u8  opcode;
+    u8  operand[2];
+    u8  accumReq;
+    u8  Xreq;
+    u8  Yreq;
+    u8  status;
+    u8  stackPointer;
+} TraceRecord;
+
+STATIC_ASSERT(sizeof(TraceRecord) == 24, trace_record_size);
+
+typedef struct TraceHeader {
+    char    magic[8];
+    u32     version;
+    u32     recordSize;
+    u64     numRecords;
+} TraceHeader;
+
+struct Trace {
+    u8              enabled;
+    TraceRecord*    records;
+    u64             mask;       // ring size - 1
+    u64             written;    // records written since start
+} trace;
+
+static inline void
+trace_record(DecodedInstruction* instruct, u8 status) {
+
+    TraceRecord* record = &trace.records[trace.written++ & trace.mask];
+
+    *record = (TraceRecord) {
+        .cycle = cpu.totalCycles, .pc = cpu.pc, .scanline = ppu.scanline, .dot = ppu.cycle,
+        .opcode = instruct->opcode,
+        .operand = { instruct->operand & 0xFF, instruct->operand >> 8 },
+        .accumReq = cpu.accumReq, .Xreq = cpu.Xreq, .Yreq = cpu.Yreq,
+        .status = status, .stackPointer = cpu.stackPointer
+    };
+}
+
+static void
+trace_dump(const char* path) {
+
+    if(!trace.records) return;
+
+    FILE* file = fopen(path, "wb");
+    if(!file) {
+        LOG("failed to open trace dump %s", path);
+        return;
+    }
+
+    u64 size = trace.mask + 1;
+    u64 count = trace.written < size ? trace.written : size;
+    TraceHeader header = {
+        .magic = TRACE_MAGIC, .version = TRACE_VERSION,
+        .recordSize = sizeof(TraceRecord), .numRecords = count
+    };
+    fwrite(&header, sizeof(header), 1, file);
+
+    // oldest record first, ring might wrap in the middle
+    u64 start = (trace.written - count) & trace.mask;
+    u64 firstPart = size - start < count ? size - start : count;
+    fwrite(&trace.records[start], sizeof(TraceRecord), firstPart, file);
+    fwrite(trace.records, sizeof(TraceRecord), count - firstPart, file);
+
+    fclose(file);
+    LOG("dumped %lu trace records to %s", count, path);
+}
+
+static void
+trace_dump_on_abort() {
+    trace_dump(TRACE_DUMP_FILE);
+}
+
+// numRecords is rounded up to power of 2
+static void
+trace_enable(u64 numRecords) {
+
+    if(!trace.records) {
+        u64 size = 1;
+        while(size < numRecords) size <<= 1;
+
+        trace.records = malloc(size * sizeof(TraceRecord));
+        ASSERT_MESSAGE(trace.records, "failed to allocate trace of %lu records", size);
+        trace.mask = size - 1;
+        trace.written = 0;
+        abortCallback = trace_dump_on_abort;
+    }
+    trace.enabled = 1;
+}
+
+static void
+trace_dispose() {
+    free(trace.records);
+    trace = (struct Trace){ 0 };
+}
+
+// nestest style line without the memory values
+static void
+trace_format(const TraceRecord* record, char* buffer, u32 bufferLen) {
+
+    Instruction instruction = instructionTable[record->opcode];
+    u8 length = 1 + addressModeOperandBytes[instruction.addressMode];
+    u8 low = record->operand[0];
+    u16 word = record->operand[0] | (record->operand[1] << 8);
+
+    char bytes[16];
+    if(length == 1) {
+        sprintf(bytes, "%02X", record->opcode);
+    } else if(length == 2) {
+        sprintf(bytes, "%02X %02X", record->opcode, low);
+    } else {
+        sprintf(bytes, "%02X %02X %02X", record->opcode, low, record->operand[1]);
+    }
+
+    char operand[16] = { 0 };
+    switch(instruction.addressMode) {
+        case IMP:
+            {
+                u8 code = instruction.instructionCode;
+                if(code == ASL || code == LSR || code == ROL || code == ROR) {
+                    sprintf(operand, "A");
+                }
+            } break;
+        case ACCUM: sprintf(operand, "A"); break;
+        case IMM:
+            {
+                // BRK padding byte is not an operand
+                if(instruction.instructionCode != BRK) sprintf(operand, "#$%02X", low);
+            } break;
+        case ZP:    sprintf(operand, "$%02X", low); break;
+        case ZPX:   sprintf(operand, "$%02X,X", low); break;
+        case ZPY:   sprintf(operand, "$%02X,Y", low); break;
+        case REL:   sprintf(operand, "$%04X", (u16)(record->pc + 2 + (i8)low)); break;
+        case ABS:   sprintf(operand, "$%04X", word); break;
+        case ABSX:  sprintf(operand, "$%04X,X", word); break;
+        case ABSY:  sprintf(operand, "$%04X,Y", word); break;
+        case IND:   sprintf(operand, "($%04X)", word); break;
+        case INDX:  sprintf(operand, "($%02X,X)", low); break;
+        case INDY:  sprintf(operand, "($%02X),Y", low); break;
+    }
+
+    char disassembly[32];
+    sprintf(disassembly, "%.3s %s", cpuInstructionStrings[record->opcode], operand);
+
+    // nestest counts pre render line as 261
+    i32 scanline = record->scanline < 0 ? 261 : record->scanline;
+
+    snprintf(buffer, bufferLen, "%04X  %-8s  %-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3d,%3d CYC:%lu",
+            record->pc, bytes, disassembly, record->accumReq, record->Xreq, record->Yreq,
+            record->status, record->stackPointer, scanline, record->dot, record->cycle);
+}
+
+// decodes dump to text, returns 0 on failure
+static u8
+trace_decode(const char* path, FILE* out) {
+
+    FILE* file = fopen(path, "rb");
+    if(!file) {
+        LOG("failed to open trace %s", path);
+        return 0;
+    }
+
+    TraceHeader header;
+    if(fread(&header, sizeof(header), 1, file) != 1 ||
+            memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+        LOG("%s is not a trace dump", path);
+        fclose(file);
+        return 0;
+    }
+
+    TraceRecord records[1024];
+    char line[128];
+    size_t numRead;
+    while((numRead = fread(records, sizeof(TraceRecord), SIZEOF_ARRAY(records), file)) > 0) {
+        for(size_t i = 0; i < numRead; i++) {
+            trace_format(&records[i], line, sizeof(line));
+            fprintf(out, "%s\n", line);
+        }
+    }
+
+    fclose(file);
+    return 1;
+}
+
+#endif /* TRACE_H */